@@ -4,15 +4,19 @@
 
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/Type.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
 #include "llvm-c/Core.h"
 #include "llvm-c/Disassembler.h"
 
@@ -33,18 +37,26 @@ void dbt::IREmitter::generateInstIR(const uint32_t GuestAddr, const dbt::OIDecod
 
   // If the address is not continuos and the last inst was not a jump, split the BB
   std::array<uint32_t, 2> Targets = getPossibleTargets(LastEmittedAddrs, LastEmittedInst);
+  if (LastEmittedAddrs != 0 && isIntrinsicCall(LastEmittedAddrs, LastEmittedInst))
+    Targets[1] = LastEmittedAddrs + 4;
   if (LastEmittedAddrs != 0 && Targets[0] != GuestAddr && Targets[1] != GuestAddr) {
     if (Trampoline != nullptr) {
-      Builder->CreateStore(genImm(LastEmittedAddrs+4), ReturnAddrs);
+      Builder->CreateStore(genCodeAddr(LastEmittedAddrs+4), ReturnAddrs);
       Builder->CreateBr(Trampoline);
     } else {
-      insertDirectExit(genImm(LastEmittedAddrs+4));
+      insertDirectExit(genCodeAddr(LastEmittedAddrs+4));
     }
 
     BasicBlock* BB = BasicBlock::Create(TheContext, "", Func);
     Builder->SetInsertPoint(BB);
+    FirstInstGen = nullptr;
   }
 
+  if (LoopIdioms.count(GuestAddr) != 0)
+    genLoopIdiom(GuestAddr, Func);
+
+  CurrentMemPartition = getMemPartition(Inst);
+
   switch (Inst.Type) {
     case dbt::OIDecoder::Nop: {
         Function *fun = Intrinsic::getDeclaration(Func->getParent(), Intrinsic::donothing);
@@ -1084,21 +1096,43 @@ void dbt::IREmitter::generateInstIR(const uint32_t GuestAddr, const dbt::OIDecod
 
     case dbt::OIDecoder::Call: {
         auto GuestTarget = ((GuestAddr & 0xF0000000) | (Inst.Addrs << 2));
-        Value* Res = genStoreRegister(31, genImm(GuestAddr + 4), Func);
+        Value* Res = genStoreRegister(31, genCodeAddr(GuestAddr + 4), Func);
+
+        // Recognized guest routines run natively and return straight to the next instruction
+        if (isIntrinsicCall(GuestAddr, Inst)) {
+          std::array<Type*, 3> ArgsType = {Type::getInt32PtrTy(TheContext), Type::getInt32PtrTy(TheContext), Type::getInt32Ty(TheContext)};
+          FunctionType *FT = FunctionType::get(Type::getVoidTy(TheContext), ArgsType, false);
+          Value* Host = Mod->getOrInsertFunction(Intrinsics::getHostSymbol(Mach->getIntrinsicName(GuestTarget)), FT);
+          Builder->CreateCall(Host, {Func->arg_begin(), Func->arg_begin()+1, genImm(DataMemOffset)});
+          setIfNotTheFirstInstGen(Res);
+          break;
+        }
+
+        Value* Callee = Mod->getFunction("r"+std::to_string(GuestTarget));
+
+        // Methods already compiled in other modules (or planned in the same batch, NativeRegions value 1) are
+        // called directly by name. The JIT binds r<addr> to the region installed for it when this module is
+        // linked (see IRJIT::findNativeRegion), the IR itself never holds a host address.
+        // Relocatable regions can't do it, the callee depends on where they are installed.
+        uint64_t Installed = GuestTarget < NATIVE_REGION_SIZE ? CurrentNativeRegions[GuestTarget] : 0;
+        if (!Callee && !IsRelocatable && Installed != 0 && Mach->isMethodEntry(GuestTarget)) {
+          std::array<Type*, 3> ArgsType = {Type::getInt32PtrTy(TheContext), Type::getInt32PtrTy(TheContext), Type::getInt32Ty(TheContext)};
+          FunctionType *FT = FunctionType::get(Type::getInt32Ty(TheContext), ArgsType, false);
+          Callee = Mod->getOrInsertFunction("r"+std::to_string(GuestTarget), FT);
+        }
 
-        llvm::Function* Callee = Mod->getFunction("r"+std::to_string(GuestTarget));
         if (Callee) {
           //
           // nextAddr <- call
           // if nextAddr is call+4, jumps to there 
           // if not return
           //
-          Value* NextAddr = Builder->CreateCall(Callee, {Func->arg_begin(), Func->arg_begin()+1, genImm(GuestTarget)});
+          Value* NextAddr = Builder->CreateCall(Callee, {Func->arg_begin(), Func->arg_begin()+1, genCodeAddr(GuestTarget)});
           
           BasicBlock* AddrOk = BasicBlock::Create(TheContext, "CallOk", Func);
           BasicBlock* AddrWrong = BasicBlock::Create(TheContext, "CallWrong", Func);
 
-          Value* CmpRes = Builder->CreateICmpEQ(genImm(GuestAddr + 4), NextAddr);
+          Value* CmpRes = Builder->CreateICmpEQ(genCodeAddr(GuestAddr + 4), NextAddr);
           Builder->CreateCondBr(CmpRes, AddrOk, AddrWrong);
 
           Builder->SetInsertPoint(AddrWrong);
@@ -1120,7 +1154,7 @@ void dbt::IREmitter::generateInstIR(const uint32_t GuestAddr, const dbt::OIDecod
     }
 
     case dbt::OIDecoder::Callr: { 
-        Value* Res = genStoreRegister(31, genImm(GuestAddr + 4), Func);
+        Value* Res = genStoreRegister(31, genCodeAddr(GuestAddr + 4), Func);
         
         if (Trampoline != nullptr) {
           Builder->CreateStore(genLoadRegister(Inst.RT, Func), ReturnAddrs);
@@ -1158,7 +1192,27 @@ void dbt::IREmitter::generateInstIR(const uint32_t GuestAddr, const dbt::OIDecod
 
     case dbt::OIDecoder::Syscall:{
         //syscallIR.generateSyscallIR(TheContext, Func, Builder, GuestAddr);
-        Value* Res = insertDirectExit(genImm(GuestAddr));
+        // r2 and r4-r7 are never cached in allocas, so the host sees and updates the guest state directly
+        if (IsToEmitInRegionSyscalls) {
+          std::array<Type*, 2> ArgsType = {Type::getInt32PtrTy(TheContext), Type::getInt32PtrTy(TheContext)};
+          FunctionType *FT = FunctionType::get(Type::getInt32Ty(TheContext), ArgsType, false);
+          Value* Host = Mod->getOrInsertFunction("dbt_region_syscall", FT);
+          Value* Res = Builder->CreateCall(Host, {Func->arg_begin(), Func->arg_begin()+1});
+          setIfNotTheFirstInstGen(Res);
+
+          BasicBlock* Handled = BasicBlock::Create(TheContext, "syscall.handled", Func);
+          BasicBlock* NotHandled = BasicBlock::Create(TheContext, "syscall.exit", Func);
+          Builder->CreateCondBr(Builder->CreateICmpEQ(Res, genImm(0)), Handled, NotHandled);
+
+          Builder->SetInsertPoint(NotHandled);
+          insertDirectExit(genCodeAddr(GuestAddr));
+          Builder->SetInsertPoint(Handled);
+
+          Func->removeFnAttr(Attribute::ArgMemOnly);
+          break;
+        }
+
+        Value* Res = insertDirectExit(genCodeAddr(GuestAddr));
         BasicBlock* BB = BasicBlock::Create(TheContext, "", Func);
         Builder->SetInsertPoint(BB);
         setIfNotTheFirstInstGen(Res);
@@ -1173,6 +1227,8 @@ void dbt::IREmitter::generateInstIR(const uint32_t GuestAddr, const dbt::OIDecod
   }
   static int inst_i = 0;
 
+  CurrentMemPartition = MemPartition::Unknown;
+
   if (!FirstInstGen) {
     std::cerr << "First Instruction not set for inst at " << std::hex << GuestAddr << "\n";
     exit(1);
@@ -1184,6 +1240,12 @@ void dbt::IREmitter::generateInstIR(const uint32_t GuestAddr, const dbt::OIDecod
   LastEmittedInst  = Inst;
 }
 
+bool dbt::IREmitter::isIntrinsicCall(uint32_t GuestAddr, dbt::OIDecoder::OIInst Inst) {
+  if (Inst.Type != dbt::OIDecoder::Call)
+    return false;
+  return Mach->getIntrinsic(getPossibleTargets(GuestAddr, Inst)[0]) != nullptr;
+}
+
 void dbt::IREmitter::updateBranchTarget(uint32_t GuestAddr, std::array<uint32_t, 2> Tgts) {
   if (!IRBranchMap[GuestAddr]) return;
 
@@ -1195,24 +1257,34 @@ void dbt::IREmitter::updateBranchTarget(uint32_t GuestAddr, std::array<uint32_t,
     if (AddrTarget == 0)
       continue;
 
+    // The back edge of a recognized loop idiom goes straight to the scalar loop
     BasicBlock *BBTarget;
-    if (IRMemoryMap.count(AddrTarget) != 0) {
-      auto TargetInst = cast<Instruction>(IRMemoryMap[AddrTarget]);
-      BasicBlock *Current = TargetInst->getParent();
-
-      if (Current->getFirstNonPHI() == TargetInst)
-        BBTarget = Current;
-      else
-        BBTarget = Current->splitBasicBlock(TargetInst);
-    } else {
-      BBTarget = BasicBlock::Create(TheContext, "", F);
-      Builder->SetInsertPoint(BBTarget);
-      insertDirectExit(genImm(AddrTarget));
-    }
+    if (LoopIdiomBodies.count(AddrTarget) != 0 && LoopIdioms[AddrTarget].Latch == GuestAddr)
+      BBTarget = LoopIdiomBodies[AddrTarget];
+    else
+      BBTarget = getTargetBlock(AddrTarget, F);
     IRBranchMap[GuestAddr]->setSuccessor(i, BBTarget);
   }
 }
 
+BasicBlock* dbt::IREmitter::getTargetBlock(uint32_t AddrTarget, Function* F) {
+  BasicBlock *BBTarget;
+  if (IRMemoryMap.count(AddrTarget) != 0) {
+    auto TargetInst = cast<Instruction>(IRMemoryMap[AddrTarget]);
+    BasicBlock *Current = TargetInst->getParent();
+
+    if (Current->getFirstNonPHI() == TargetInst)
+      BBTarget = Current;
+    else
+      BBTarget = Current->splitBasicBlock(TargetInst);
+  } else {
+    BBTarget = BasicBlock::Create(TheContext, "", F);
+    Builder->SetInsertPoint(BBTarget);
+    insertDirectExit(genCodeAddr(AddrTarget));
+  }
+  return BBTarget;
+}
+
 void dbt::IREmitter::processBranchesTargets(const OIInstList& OIRegion) {
   uint32_t NextAddrs = 0;
   for (unsigned I = 0; I < OIRegion.size(); I++) {
@@ -1235,7 +1307,8 @@ Function* dbt::IREmitter::createFunctionPrototype(uint32_t EntryAddress) {
   FunctionType *FT = FunctionType::get(Type::getInt32Ty(TheContext), ArgsType, false);
   Function *F = cast<Function>(Mod->getOrInsertFunction("r" + std::to_string(EntryAddress), FT));
 
-  F->addFnAttr(Attribute::ArgMemOnly);
+  if (!IsRelocatable)
+    F->addFnAttr(Attribute::ArgMemOnly);
   F->addFnAttr(Attribute::AlwaysInline);
   //F->setCallingConv(CallingConv::Fast);
   F->addAttribute(1, Attribute::NoAlias);
@@ -1278,19 +1351,60 @@ void dbt::IREmitter::generateFunctionIR(uint32_t EntryAddress, const OIInstList&
   for (auto Pair : OIRegion)
     IRMemoryMap[Pair[0]] = nullptr;
 
+  findLoopIdioms(OIRegion);
+
+  MemPartitions.clear();
+  findMemoryPartitions(OIRegion);
+
   for (auto Pair : OIRegion) {
     dbt::OIDecoder::OIInst Inst = dbt::OIDecoder::decode(Pair[1]);  
     generateInstIR(Pair[0], Inst);
   }
 
-  insertDirectExit(genImm(OIRegion.back()[0]+4));
+  insertDirectExit(genCodeAddr(OIRegion.back()[0]+4));
 
   processBranchesTargets(OIRegion);
+  processLoopIdiomExits();
 
   Builder->SetInsertPoint(RegionEntry);
   Builder->CreateBr(BB);
 
   emmitExit(F);
+
+  if (IsToPartitionMemory)
+    versionMemoryPartitions(F);
+
+  if (IsToEmitLoopMetadata)
+    formLoops(F);
+}
+
+// Gives each natural loop a preheader, a single latch and dedicated exits, and tags it with its guest
+// header address so the vectorizer results can be traced back to guest code
+void dbt::IREmitter::formLoops(Function* F) {
+  LLVMContext& C = F->getContext();
+
+  std::unordered_map<BasicBlock*, uint32_t> HeaderAddrs;
+  for (auto& KV : IRMemoryMap) {
+    auto I = dyn_cast_or_null<Instruction>(KV.second);
+    if (I && I->getParent()->getFirstNonPHI() == I)
+      HeaderAddrs[I->getParent()] = KV.first;
+  }
+
+  DominatorTree DT(*F);
+  LoopInfo LI(DT);
+
+  for (Loop* L : LI.getLoopsInPreorder()) {
+    simplifyLoop(L, &DT, &LI, nullptr, nullptr, false);
+
+    if (HeaderAddrs.count(L->getHeader()) == 0)
+      continue;
+
+    auto Header = ConstantInt::get(Type::getInt32Ty(C), HeaderAddrs[L->getHeader()]);
+    MDNode* HeaderMD = MDNode::get(C, {MDString::get(C, "oi.loop.header"), ConstantAsMetadata::get(Header)});
+    MDNode* LoopID = MDNode::getDistinct(C, {nullptr, HeaderMD});
+    LoopID->replaceOperandWith(0, LoopID);
+    L->setLoopID(LoopID);
+  }
 }
 
 void dbt::IREmitter::generateRegionIR(std::vector<uint32_t> EntryAddresses, OIInstList& OIRegion,
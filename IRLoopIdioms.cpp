@@ -0,0 +1,201 @@
+#include <IREmitter.hpp>
+#include <OIPrinter.hpp>
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+static unsigned getAccessSize(dbt::OIDecoder::OIInstType Type) {
+  switch (Type) {
+    case dbt::OIDecoder::Ldb:
+    case dbt::OIDecoder::Ldbu:
+    case dbt::OIDecoder::Stb:
+      return 1;
+    case dbt::OIDecoder::Ldh:
+    case dbt::OIDecoder::Ldhu:
+    case dbt::OIDecoder::Sth:
+      return 2;
+    case dbt::OIDecoder::Ldw:
+    case dbt::OIDecoder::Stw:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+static bool isStore(dbt::OIDecoder::OIInstType Type) {
+  return Type == dbt::OIDecoder::Stb || Type == dbt::OIDecoder::Sth || Type == dbt::OIDecoder::Stw;
+}
+
+// Looks for single block loops closed by a backward jne/jnez whose body is only a store (fill) or a
+// load followed by a store of the loaded value (copy), plus addi inductions stepping the pointers by the
+// access size. Those are later emitted as llvm.memmove/llvm.memset guarded by a trip count check.
+void dbt::IREmitter::findLoopIdioms(const OIInstList& OIRegion) {
+  LoopIdioms.clear();
+  LoopIdiomBodies.clear();
+  LoopIdiomExits.clear();
+
+  if (!IsToEmitLoopIdioms)
+    return;
+
+  std::unordered_map<uint32_t, uint32_t> Words;
+  for (auto Pair : OIRegion)
+    Words[Pair[0]] = Pair[1];
+
+  for (auto Pair : OIRegion) {
+    uint32_t Latch = Pair[0];
+    OIDecoder::OIInst Br = OIDecoder::decode(Pair[1]);
+    if (Br.Type != OIDecoder::Jne && Br.Type != OIDecoder::Jnez)
+      continue;
+
+    uint32_t Header = OIDecoder::getPossibleTargets(Latch, Br)[0];
+    if (Header >= Latch)
+      continue;
+
+    LoopIdiom L;
+    L.Header = Header;
+    L.Latch  = Latch;
+    L.Branch = Br;
+
+    bool HasLoad = false, HasStore = false, Valid = true;
+    for (uint32_t Addrs = Header; Addrs < Latch && Valid; Addrs += 4) {
+      if (Words.count(Addrs) == 0) {
+        Valid = false;
+        break;
+      }
+
+      OIDecoder::OIInst I = OIDecoder::decode(Words[Addrs]);
+      if (I.Type == OIDecoder::Nop)
+        continue;
+
+      if (I.Type == OIDecoder::Addi && I.RS == I.RT && I.RT != 0 && L.Inductions.count(I.RT) == 0) {
+        L.Inductions[I.RT] = {I.Imm, Addrs};
+      } else if (getAccessSize(I.Type) != 0 && !isStore(I.Type) && !HasLoad && !HasStore) {
+        L.Load = I;
+        L.LoadAddrs = Addrs;
+        HasLoad = true;
+      } else if (isStore(I.Type) && !HasStore) {
+        L.Store = I;
+        L.StoreAddrs = Addrs;
+        HasStore = true;
+      } else {
+        Valid = false;
+      }
+    }
+
+    if (!Valid || !HasStore)
+      continue;
+
+    unsigned Size = getAccessSize(L.Store.Type);
+    uint16_t Value = L.Store.RT;
+
+    // Pointers must walk forward one element per iteration
+    if (L.Inductions.count(L.Store.RS) == 0 || L.Inductions[L.Store.RS].first != (int32_t) Size)
+      continue;
+
+    L.IsCopy = HasLoad;
+    if (L.IsCopy) {
+      if (getAccessSize(L.Load.Type) != Size || L.Load.RT != Value || Value == 0 || L.Load.RS == L.Store.RS)
+        continue;
+      if (L.Inductions.count(L.Load.RS) == 0 || L.Inductions[L.Load.RS].first != (int32_t) Size)
+        continue;
+    }
+
+    // The stored value must be the loaded one (copy) or loop invariant (fill)
+    if (L.Inductions.count(Value) != 0)
+      continue;
+
+    uint16_t Counter = Br.RS, End = Br.RT;
+    if (Br.Type == OIDecoder::Jne && L.Inductions.count(Counter) == 0)
+      std::swap(Counter, End);
+    if (L.Inductions.count(Counter) == 0 || L.Inductions[Counter].first == 0)
+      continue;
+    if (Br.Type == OIDecoder::Jne && (L.Inductions.count(End) != 0 || (L.IsCopy && End == Value)))
+      continue;
+
+    L.Counter = Counter;
+    L.End     = Br.Type == OIDecoder::Jne ? End : 0;
+    LoopIdioms[Header] = L;
+  }
+}
+
+void dbt::IREmitter::genLoopIdiom(uint32_t Header, Function* Func) {
+  LoopIdiom& L = LoopIdioms[Header];
+  unsigned Size = getAccessSize(L.Store.Type);
+  int32_t CounterStep = L.Inductions[L.Counter].first;
+
+  std::map<uint16_t, Value*> Initial;
+  for (auto& KV : L.Inductions)
+    Initial[KV.first] = genLoadRegister(KV.first, Func);
+
+  // Trip count: first iteration where Counter + N*Step hits End (the comparison follows the update)
+  Value* End  = genLoadRegister(L.End, Func);
+  Value* Diff = CounterStep > 0 ? Builder->CreateSub(End, Initial[L.Counter]) : Builder->CreateSub(Initial[L.Counter], End);
+  Value* Step = genImm(CounterStep > 0 ? CounterStep : -CounterStep);
+  Value* N    = Builder->CreateUDiv(Diff, Step);
+  Value* Len  = Builder->CreateMul(N, genImm(Size));
+
+  Value* Ok = Builder->CreateICmpEQ(Builder->CreateURem(Diff, Step), genImm(0));
+  Ok = Builder->CreateAnd(Ok, Builder->CreateICmpNE(N, genImm(0)));
+  Ok = Builder->CreateAnd(Ok, Builder->CreateICmpULE(N, genImm(0x7FFFFFFF / Size)));
+
+  auto getStartAddrs = [&](OIDecoder::OIInst I, uint32_t InstAddrs) {
+    auto Induction = L.Inductions[I.RS];
+    uint32_t Offset = I.Imm + (Induction.second < InstAddrs ? Size : 0);
+    return Builder->CreateAdd(Initial[I.RS], genImm(Offset));
+  };
+
+  Value* Dst = getStartAddrs(L.Store, L.StoreAddrs);
+  Value* Src = nullptr;
+  Value* Fill = nullptr;
+
+  if (L.IsCopy) {
+    // Copying forward is only equivalent to memmove when it never reads bytes it already wrote
+    Src = getStartAddrs(L.Load, L.LoadAddrs);
+    Value* Forward = Builder->CreateICmpULE(Dst, Src);
+    Value* Disjoint = Builder->CreateICmpUGE(Builder->CreateSub(Dst, Src), Len);
+    Ok = Builder->CreateAnd(Ok, Builder->CreateOr(Forward, Disjoint));
+  } else {
+    // memset can only fill a byte pattern
+    Value* V = genLoadRegister(L.Store.RT, Func);
+    Value* Byte = Builder->CreateAnd(V, genImm(0xFF));
+    if (Size == 2)
+      Ok = Builder->CreateAnd(Ok, Builder->CreateICmpEQ(Builder->CreateAnd(V, genImm(0xFFFF)), Builder->CreateMul(Byte, genImm(0x0101))));
+    else if (Size == 4)
+      Ok = Builder->CreateAnd(Ok, Builder->CreateICmpEQ(V, Builder->CreateMul(Byte, genImm(0x01010101))));
+    Fill = Builder->CreateIntCast(Byte, Type::getInt8Ty(TheContext), false);
+  }
+
+  BasicBlock* FastBB = BasicBlock::Create(TheContext, "idiom", Func);
+  BasicBlock* BodyBB = BasicBlock::Create(TheContext, "idiom.fallback", Func);
+  Builder->CreateCondBr(Ok, FastBB, BodyBB);
+
+  Builder->SetInsertPoint(FastBB);
+  if (L.IsCopy)
+    Builder->CreateMemMove(genDataByteVecPtr(Dst, Func), 1, genDataByteVecPtr(Src, Func), 1, Len);
+  else
+    Builder->CreateMemSet(genDataByteVecPtr(Dst, Func), Fill, Len, 1);
+
+  for (auto& KV : L.Inductions)
+    genStoreRegister(KV.first, Builder->CreateAdd(Initial[KV.first], Builder->CreateMul(N, genImm(KV.second.first))), Func);
+
+  // The copied value register ends up with the last element, which is now also at the last destination slot
+  if (L.IsCopy) {
+    Value* Last = Builder->CreateAdd(Dst, Builder->CreateMul(Builder->CreateSub(N, genImm(1)), genImm(Size)));
+    Value* V = Builder->CreateLoad(genDataVecPtr(Last, Func, Type::getIntNTy(TheContext, Size*8), Size));
+    bool Signed = L.Load.Type == OIDecoder::Ldb || L.Load.Type == OIDecoder::Ldh;
+    genStoreRegister(L.Load.RT, Builder->CreateIntCast(V, Type::getInt32Ty(TheContext), Signed), Func);
+  }
+
+  LoopIdiomExits.push_back({Builder->CreateBr(BodyBB), L.Latch + 4});
+  LoopIdiomBodies[Header] = BodyBB;
+
+  Builder->SetInsertPoint(BodyBB);
+}
+
+void dbt::IREmitter::processLoopIdiomExits() {
+  for (auto Exit : LoopIdiomExits)
+    Exit.first->setSuccessor(0, getTargetBlock(Exit.second, Exit.first->getParent()->getParent()));
+}
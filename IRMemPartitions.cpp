@@ -0,0 +1,247 @@
+#include <IREmitter.hpp>
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <set>
+
+using namespace llvm;
+
+#define SP_REG 29
+#define GP_REG 28
+
+// Immediate window reachable from a base register plus the widest access
+#define PARTITION_WINDOW 0x8008
+
+static bool isBaseAddressed(dbt::OIDecoder::OIInstType Type) {
+  switch (Type) {
+    case dbt::OIDecoder::Ldw:
+    case dbt::OIDecoder::Ldh:
+    case dbt::OIDecoder::Ldhu:
+    case dbt::OIDecoder::Ldb:
+    case dbt::OIDecoder::Ldbu:
+    case dbt::OIDecoder::Stw:
+    case dbt::OIDecoder::Sth:
+    case dbt::OIDecoder::Stb:
+    case dbt::OIDecoder::Ldc1:
+    case dbt::OIDecoder::Lwc1:
+    case dbt::OIDecoder::Sdc1:
+    case dbt::OIDecoder::Swc1:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Conservative: anything we don't know the destination of may write any register it names
+static bool mayWriteReg(dbt::OIDecoder::OIInst I, uint16_t R) {
+  switch (I.Type) {
+    case dbt::OIDecoder::Stw:
+    case dbt::OIDecoder::Sth:
+    case dbt::OIDecoder::Stb:
+    case dbt::OIDecoder::Sdc1:
+    case dbt::OIDecoder::Swc1:
+    case dbt::OIDecoder::Sdxc1:
+    case dbt::OIDecoder::Swxc1:
+    case dbt::OIDecoder::Jeq:
+    case dbt::OIDecoder::Jne:
+    case dbt::OIDecoder::Jeqz:
+    case dbt::OIDecoder::Jnez:
+    case dbt::OIDecoder::Jlez:
+    case dbt::OIDecoder::Jgtz:
+    case dbt::OIDecoder::Jltz:
+    case dbt::OIDecoder::Jgez:
+    case dbt::OIDecoder::Jump:
+    case dbt::OIDecoder::Jumpr:
+    case dbt::OIDecoder::Call:
+    case dbt::OIDecoder::Callr:
+    case dbt::OIDecoder::Nop:
+    case dbt::OIDecoder::Ldc1:
+    case dbt::OIDecoder::Lwc1:
+    case dbt::OIDecoder::Ldxc1:
+    case dbt::OIDecoder::Lwxc1:
+      return false;
+    case dbt::OIDecoder::Ldw:
+    case dbt::OIDecoder::Ldh:
+    case dbt::OIDecoder::Ldhu:
+    case dbt::OIDecoder::Ldb:
+    case dbt::OIDecoder::Ldbu:
+    case dbt::OIDecoder::Addi:
+    case dbt::OIDecoder::Andi:
+    case dbt::OIDecoder::Ori:
+    case dbt::OIDecoder::Xori:
+    case dbt::OIDecoder::Slti:
+    case dbt::OIDecoder::Sltiu:
+    case dbt::OIDecoder::Ldi:
+      return I.RT == R;
+    default:
+      return I.RS == R || I.RT == R || I.RD == R || I.RV == R;
+  }
+}
+
+// Stack (SP based) and global (GP based) accesses are only told apart when the region keeps SP and GP
+// as base pointers. SP may still move by addi, which only widens the window checked at the entry, as
+// long as every addi runs at most once: SP adjusted inside a loop (or by a region function called from
+// one) has no static bound.
+void dbt::IREmitter::findMemoryPartitions(const OIInstList& OIRegion) {
+  HasStackPartition  = IsToPartitionMemory;
+  HasGlobalPartition = IsToPartitionMemory;
+  StackAdjustment = 0;
+
+  std::set<uint32_t> Addrs;
+  for (auto Pair : OIRegion)
+    Addrs.insert(Pair[0]);
+
+  // Backward branches inside the region give the address ranges of its loops
+  std::vector<std::pair<uint32_t, uint32_t>> Loops;
+  std::vector<uint32_t> Calls;
+  for (auto Pair : OIRegion) {
+    OIDecoder::OIInst I = OIDecoder::decode(Pair[1]);
+    if (!OIDecoder::isControlFlowInst(I) || OIDecoder::isIndirectBranch(I))
+      continue;
+
+    uint32_t Target = OIDecoder::getPossibleTargets(Pair[0], I)[0];
+    if (Addrs.count(Target) == 0)
+      continue;
+    if (I.Type == OIDecoder::Call)
+      Calls.push_back(Pair[0]);
+    else if (Target <= Pair[0])
+      Loops.push_back({Target, Pair[0]});
+  }
+
+  auto isInLoop = [&](uint32_t Addrs) {
+    for (auto& L : Loops)
+      if (L.first <= Addrs && Addrs <= L.second)
+        return true;
+    return false;
+  };
+
+  bool CallsInLoop = false;
+  for (auto C : Calls)
+    CallsInLoop |= isInLoop(C);
+
+  bool AdjustsSP = false;
+  for (auto Pair : OIRegion) {
+    OIDecoder::OIInst I = OIDecoder::decode(Pair[1]);
+    if (I.Type == OIDecoder::Addi && I.RS == SP_REG && I.RT == SP_REG && !isInLoop(Pair[0])) {
+      StackAdjustment += I.Imm < 0 ? -I.Imm : I.Imm;
+      AdjustsSP = true;
+    } else if (mayWriteReg(I, SP_REG)) {
+      HasStackPartition = false;
+    }
+
+    if (mayWriteReg(I, GP_REG))
+      HasGlobalPartition = false;
+  }
+
+  if (AdjustsSP && CallsInLoop)
+    HasStackPartition = false;
+
+  // The partitions are only useful against each other
+  if (!HasStackPartition || !HasGlobalPartition)
+    HasStackPartition = HasGlobalPartition = false;
+}
+
+dbt::IREmitter::MemPartition dbt::IREmitter::getMemPartition(OIDecoder::OIInst I) {
+  if (!isBaseAddressed(I.Type))
+    return MemPartition::Unknown;
+  if (I.RS == SP_REG && HasStackPartition)
+    return MemPartition::Stack;
+  if (I.RS == GP_REG && HasGlobalPartition)
+    return MemPartition::Global;
+  return MemPartition::Unknown;
+}
+
+void dbt::IREmitter::tagMemoryPartitions(Function* F) {
+  LLVMContext& C = F->getContext();
+  MDBuilder MDB(C);
+
+  MDNode* Domain = MDB.createAnonymousAliasScopeDomain("oi.mem");
+  std::array<MDNode*, 4> Scopes = {
+    MDB.createAnonymousAliasScope(Domain, "register"),
+    MDB.createAnonymousAliasScope(Domain, "stack"),
+    MDB.createAnonymousAliasScope(Domain, "global"),
+    MDB.createAnonymousAliasScope(Domain, "unknown")
+  };
+
+  std::array<MDNode*, 4> NoAlias = {
+    MDNode::get(C, {Scopes[MemPartition::Stack], Scopes[MemPartition::Global], Scopes[MemPartition::Unknown]}),
+    MDNode::get(C, {Scopes[MemPartition::Register], Scopes[MemPartition::Global]}),
+    MDNode::get(C, {Scopes[MemPartition::Register], Scopes[MemPartition::Stack]}),
+    MDNode::get(C, {Scopes[MemPartition::Register]})
+  };
+
+  Argument* Regs = &*F->arg_begin();
+  Argument* Mem  = &*(F->arg_begin()+1);
+
+  for (auto& BB : *F) {
+    for (auto& I : BB) {
+      Value* Ptr = nullptr;
+      if (auto LI = dyn_cast<LoadInst>(&I))
+        Ptr = LI->getPointerOperand();
+      else if (auto SI = dyn_cast<StoreInst>(&I))
+        Ptr = SI->getPointerOperand();
+      else
+        continue;
+
+      MemPartition P = MemPartition::Unknown;
+      if (MemPartitions.count(Ptr) != 0) {
+        P = MemPartitions[Ptr];
+      } else {
+        Value* Base = Ptr;
+        while (isa<GEPOperator>(Base) || isa<BitCastOperator>(Base))
+          Base = cast<Operator>(Base)->getOperand(0);
+
+        if (Base == Regs)
+          P = MemPartition::Register;
+        else if (Base != Mem)
+          continue;
+      }
+
+      I.setMetadata(LLVMContext::MD_alias_scope, MDNode::get(C, {Scopes[P]}));
+      I.setMetadata(LLVMContext::MD_noalias, NoAlias[P]);
+    }
+  }
+}
+
+// Keeps an untagged copy of the function and only runs the tagged one when the SP and GP windows touched
+// by the region can't overlap
+void dbt::IREmitter::versionMemoryPartitions(Function* F) {
+  if (!HasStackPartition || !HasGlobalPartition) {
+    tagMemoryPartitions(F);
+    return;
+  }
+
+  ValueToValueMapTy VMap;
+  Function* Untagged = CloneFunction(F, VMap);
+  Untagged->setName(F->getName() + ".untagged");
+  Untagged->setLinkage(GlobalValue::InternalLinkage);
+
+  tagMemoryPartitions(F);
+
+  auto Br = cast<BranchInst>(RegionEntry->getTerminator());
+  Builder->SetInsertPoint(Br);
+
+  Value* SP = Builder->CreateLoad(genRegisterVecPtr(SP_REG, F, RegType::Int));
+  Value* GP = Builder->CreateLoad(genRegisterVecPtr(GP_REG, F, RegType::Int));
+  Value* Distance = Builder->CreateSub(SP, GP);
+  Value* Disjoint = Builder->CreateAnd(Builder->CreateICmpUGT(SP, GP),
+      Builder->CreateICmpUGE(Distance, genImm(2*PARTITION_WINDOW + StackAdjustment)));
+
+  BasicBlock* Fallback = BasicBlock::Create(TheContext, "mem.fallback", F);
+  Builder->CreateCondBr(Disjoint, Br->getSuccessor(0), Fallback);
+  Br->eraseFromParent();
+
+  Builder->SetInsertPoint(Fallback);
+  std::vector<Value*> Args;
+  for (auto& A : F->args())
+    Args.push_back(&A);
+  Builder->CreateRet(Builder->CreateCall(Untagged, Args));
+
+  FirstInstGen = nullptr;
+}
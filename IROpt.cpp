@@ -4,12 +4,15 @@
 
 // Opt
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/Passes.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/Bitcode/BitcodeWriterPass.h"
 
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/LegacyPassManagers.h"
 #include "llvm/IR/IRPrintingPasses.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -19,67 +22,231 @@
 #include "timer.hpp"
 
 #include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Vectorize.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 
 constexpr unsigned int str2int(const char* str, int h = 0) {
     return !str[h] ? 5381 : (str2int(str, h+1) * 33) ^ str[h];
 }
 
-void dbt::IROpt::populateFuncPassManager(llvm::legacy::FunctionPassManager* FPM, std::vector<std::string> PassesNames) {
-  for (std::string PassName : PassesNames) {
-    switch (str2int(PassName.c_str())) {
-      case str2int("instcombine"):
-        FPM->add(llvm::createInstructionCombiningPass());
-        break;
-      case str2int("simplifycfg"):
-        FPM->add(llvm::createCFGSimplificationPass());
-        break;
-      case str2int("reassociate"):
-        FPM->add(llvm::createReassociatePass());
-        break;
-      case str2int("gvn"):
-        FPM->add(llvm::createNewGVNPass());
-        break;
-      case str2int("die"):
-        FPM->add(llvm::createDeadInstEliminationPass());
-        break;
-      case str2int("dce"):
-        FPM->add(llvm::createDeadCodeEliminationPass());
-        break;
+void dbt::IROpt::addPass(llvm::legacy::FunctionPassManager* FPM, std::string PassName) {
+  switch (str2int(PassName.c_str())) {
+    case str2int("instcombine"):
+      FPM->add(llvm::createInstructionCombiningPass());
+      break;
+    case str2int("simplifycfg"):
+      FPM->add(llvm::createCFGSimplificationPass());
+      break;
+    case str2int("reassociate"):
+      FPM->add(llvm::createReassociatePass());
+      break;
+    case str2int("gvn"):
+      FPM->add(llvm::createNewGVNPass());
+      break;
+    case str2int("die"):
+      FPM->add(llvm::createDeadInstEliminationPass());
+      break;
+    case str2int("dce"):
+      FPM->add(llvm::createDeadCodeEliminationPass());
+      break;
 //      case str2int("mem2reg"):
 //        FPM->add(llvm::createPromoteMemoryToRegisterPass());
 //        break;
-      case str2int("licm"):
-        FPM->add(llvm::createLICMPass());
-        break;
-      case str2int("memcpyopt"):
-        FPM->add(llvm::createMemCpyOptPass());
-        break;
-      case str2int("loop-unswitch"):
-        FPM->add(llvm::createLoopUnswitchPass());
-        break;
-      case str2int("indvars"):
-        FPM->add(llvm::createIndVarSimplifyPass());       // Canonicalize indvars
-        break;
-      case str2int("loop-deletion"):
-        FPM->add(llvm::createLoopDeletionPass());         // Delete dead loops
-        break;
-      case str2int("loop-predication"):
-        FPM->add(llvm::createLoopPredicationPass());
-        break;
-      case str2int("loop-unroll"):
-        FPM->add(llvm::createSimpleLoopUnrollPass());     // Unroll small loops
-        break;
-      default:
-        std::cerr << "Trying to use an invalid optimization pass!\n";
-        exit(1);
-        break;
-    }
+    case str2int("licm"):
+      FPM->add(llvm::createLICMPass());
+      break;
+    case str2int("memcpyopt"):
+      FPM->add(llvm::createMemCpyOptPass());
+      break;
+    case str2int("loop-unswitch"):
+      FPM->add(llvm::createLoopUnswitchPass());
+      break;
+    case str2int("indvars"):
+      FPM->add(llvm::createIndVarSimplifyPass());       // Canonicalize indvars
+      break;
+    case str2int("loop-deletion"):
+      FPM->add(llvm::createLoopDeletionPass());         // Delete dead loops
+      break;
+    case str2int("loop-predication"):
+      FPM->add(llvm::createLoopPredicationPass());
+      break;
+    case str2int("loop-unroll"):
+      FPM->add(llvm::createSimpleLoopUnrollPass());     // Unroll small loops
+      break;
+    case str2int("sroa"):
+      FPM->add(llvm::createSROAPass());
+      break;
+    case str2int("loop-rotate"):
+      FPM->add(llvm::createLoopRotatePass());
+      break;
+    case str2int("loop-vectorize"):
+      FPM->add(llvm::createLoopVectorizePass());
+      break;
+    case str2int("slp-vectorizer"):
+      FPM->add(llvm::createSLPVectorizerPass());
+      break;
+    default:
+      std::cerr << "Trying to use an invalid optimization pass!\n";
+      exit(1);
+      break;
+  }
+}
+
+bool dbt::IROpt::isKnownPass(const std::string& PassName) {
+  switch (str2int(PassName.c_str())) {
+    case str2int("instcombine"): case str2int("simplifycfg"): case str2int("reassociate"): case str2int("gvn"):
+    case str2int("die"): case str2int("dce"): case str2int("licm"): case str2int("memcpyopt"):
+    case str2int("loop-unswitch"): case str2int("indvars"): case str2int("loop-deletion"):
+    case str2int("loop-predication"): case str2int("loop-unroll"): case str2int("sroa"): case str2int("loop-rotate"):
+    case str2int("loop-vectorize"): case str2int("slp-vectorizer"):
+      return true;
+    default:
+      return false;
   }
+}
+
+void dbt::IROpt::populateFuncPassManager(llvm::legacy::FunctionPassManager* FPM, std::vector<std::string> PassesNames) {
+  // Without the target cost model the vectorizers think there are no vector registers
+  if (TM)
+    FPM->add(llvm::createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+
+  for (std::string PassName : PassesNames)
+    addPass(FPM, PassName);
   std::cerr << "\n";
 }
 
+// Per pass compile time, shared by the IROpt of every compilation thread
+namespace {
+  struct PassCost {
+    double Ms = 0;
+    uint64_t Insts = 0;
+    unsigned Runs = 0, Exceeded = 0, Skipped = 0;
+  };
+
+  std::map<std::string, PassCost> PassCosts;
+  std::mutex PassCostsMtx;
+  bool IsToTimePasses = false;
+  double CompileBudget = 0;
+  unsigned DowngradedRegions = 0;
+}
+
+// Before a pass was seen, its cost is guessed from the region size alone
+#define DEFAULT_MS_PER_INST 0.001
+#define MAX_EXCEEDED 3
+
+static bool isEssentialPass(const std::string& Name) {
+  return Name == "instcombine" || Name == "simplifycfg" || Name == "dce" || Name == "die";
+}
+
+static unsigned countInsts(llvm::Module* M) {
+  unsigned Size = 0;
+  for (auto& F : *M)
+    for (auto& BB : F)
+      Size += BB.size();
+  return Size;
+}
+
+void dbt::IROpt::setPassTiming(bool T) {
+  IsToTimePasses = T;
+}
+
+void dbt::IROpt::setCompileBudget(double Ms) {
+  CompileBudget = Ms;
+  IsToTimePasses |= Ms > 0;
+}
+
+double dbt::IROpt::getCompileBudget() {
+  return CompileBudget;
+}
+
+bool dbt::IROpt::isTimingPasses() {
+  return IsToTimePasses;
+}
+
+// Runs the passes one at a time. With a budget, optional passes whose predicted cost (their time per IR
+// instruction so far times the current size) doesn't fit in what is left are skipped, and optional passes
+// that took over half the budget on MAX_EXCEEDED regions are not run anymore. Essential passes always run.
+void dbt::IROpt::runTimedPasses(llvm::Module* M, const std::vector<std::string>& Passes) {
+  double Remaining = CompileBudget;
+  bool Downgraded = false;
+
+  for (auto& Name : Passes) {
+    unsigned Size = countInsts(M);
+
+    if (CompileBudget > 0) {
+      std::lock_guard<std::mutex> Lock(PassCostsMtx);
+      PassCost& C = PassCosts[Name];
+      double Predicted = (C.Insts != 0 ? C.Ms / C.Insts : DEFAULT_MS_PER_INST) * Size;
+      if (!isEssentialPass(Name) && (C.Exceeded >= MAX_EXCEEDED || Predicted > Remaining)) {
+        C.Skipped += 1;
+        Downgraded = true;
+        continue;
+      }
+    }
+
+    llvm::legacy::FunctionPassManager FPM(M);
+    if (TM)
+      FPM.add(llvm::createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+    addPass(&FPM, Name);
+    FPM.doInitialization();
+
+    auto Start = std::chrono::steady_clock::now();
+    for (auto& F : *M)
+      FPM.run(F);
+    double Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+    Remaining -= Ms;
+
+    std::lock_guard<std::mutex> Lock(PassCostsMtx);
+    PassCost& C = PassCosts[Name];
+    C.Ms += Ms;
+    C.Insts += Size;
+    C.Runs += 1;
+    if (CompileBudget > 0 && Ms > CompileBudget / 2)
+      C.Exceeded += 1;
+  }
+
+  if (Downgraded) {
+    std::lock_guard<std::mutex> Lock(PassCostsMtx);
+    DowngradedRegions += 1;
+  }
+}
+
+void dbt::IROpt::dumpPassStats() {
+  std::lock_guard<std::mutex> Lock(PassCostsMtx);
+  std::cerr << "Pass times (runs, total ms, us per 1k IR insts, skipped):\n";
+  for (auto& P : PassCosts) {
+    std::cerr << "  " << P.first << ": " << P.second.Runs << ", " << P.second.Ms << ", "
+      << (P.second.Insts ? 1000000 * P.second.Ms / P.second.Insts : 0) << ", " << P.second.Skipped;
+    if (P.second.Exceeded >= MAX_EXCEEDED && !isEssentialPass(P.first))
+      std::cerr << " (disabled)";
+    std::cerr << "\n";
+  }
+  if (CompileBudget > 0)
+    std::cerr << "Regions downgraded by the compile budget: " << DowngradedRegions << "\n";
+}
+
+std::vector<std::string> dbt::IROpt::getPassList(OptLevel Level) {
+  if (Level == OptLevel::Vector)
+    return {"sroa", "instcombine", "simplifycfg", "reassociate", "gvn", "die", "dce", "instcombine", "licm",
+        "memcpyopt", "loop-rotate", "licm", "instcombine", "indvars", "loop-deletion", "loop-vectorize",
+        "slp-vectorizer", "instcombine", "simplifycfg", "licm", "gvn"};
+
+  return {"instcombine", "simplifycfg", "reassociate", "gvn", "die", "dce", "instcombine", "licm", 
+      "memcpyopt", "loop-unswitch", "instcombine", "indvars", "loop-deletion", "loop-predication", "loop-unroll",
+      "simplifycfg", "instcombine", "licm", "gvn"};
+}
+
 void dbt::IROpt::customOptimizeIRFunction(llvm::Module* M, std::vector<std::string> Opts) {
-  std::cerr << "Custom opt " << Opts[1] << "\n";
+  if (IsToTimePasses) {
+    runTimedPasses(M, Opts);
+    return;
+  }
+
   auto PM = std::make_unique<llvm::legacy::FunctionPassManager>(M);
   populateFuncPassManager(PM.get(), Opts);
   PM->doInitialization();
@@ -90,22 +257,169 @@ void dbt::IROpt::customOptimizeIRFunction(llvm::Module* M, std::vector<std::stri
 void 
 dbt::IROpt::optimizeIRFunction(llvm::Module *M, OptLevel Level, uint32_t EntryAddress, uint32_t ExecNumber, 
                                 std::string BinPath) {
+  if (IsToTimePasses && (Level == OptLevel::Basic || Level == OptLevel::Vector)) {
+    runTimedPasses(M, getPassList(Level));
+    return;
+  }
+
   // Lazy initialization
   if (Level == OptLevel::Basic) {
     if (!BasicPM) {
       BasicPM = std::make_unique<llvm::legacy::FunctionPassManager>(M);
-      populateFuncPassManager(BasicPM.get(),  
-        {"instcombine", "simplifycfg", "reassociate", "gvn", "die", "dce", "instcombine", "licm", 
-        "memcpyopt", "loop-unswitch", "instcombine", "indvars", "loop-deletion", "loop-predication", "loop-unroll",
-        "simplifycfg", "instcombine", "licm", "gvn"});
+      populateFuncPassManager(BasicPM.get(), getPassList(OptLevel::Basic));
       BasicPM->doInitialization();
 
     }
-/*    auto MPM = std::make_unique<llvm::legacy::PassManager>();
-    MPM->add(llvm::createFunctionInliningPass());
-    MPM->run(*M);*/
 
     for (auto& F : *M)
       BasicPM->run(F);
-  } 
+  } else if (Level == OptLevel::Vector) {
+    if (!VectorPM) {
+      VectorPM = std::make_unique<llvm::legacy::FunctionPassManager>(M);
+      populateFuncPassManager(VectorPM.get(), getPassList(OptLevel::Vector));
+      VectorPM->doInitialization();
+    }
+
+    for (auto& F : *M)
+      VectorPM->run(F);
+  }
+}
+
+namespace {
+  unsigned IPOSizeLimit = 20000;
+  std::atomic<unsigned> IPORegions{0}, IPOInlined{0}, IPOOversized{0};
+}
+
+void dbt::IROpt::setIPOSizeLimit(unsigned Limit) {
+  IPOSizeLimit = Limit;
+}
+
+unsigned dbt::IROpt::getIPOSizeLimit() {
+  return IPOSizeLimit;
+}
+
+// Size of F once every in-module callee was inlined into it (recursive calls are never inlined)
+static uint64_t getInlinedSize(llvm::Function* F, std::map<llvm::Function*, uint64_t>& Sizes,
+                               std::set<llvm::Function*>& Visiting) {
+  if (Sizes.count(F) != 0)
+    return Sizes[F];
+  if (Visiting.count(F) != 0)
+    return 0;
+  Visiting.insert(F);
+
+  uint64_t Size = 0;
+  for (auto& BB : *F) {
+    for (auto& I : BB) {
+      Size += 1;
+      auto CI = llvm::dyn_cast<llvm::CallInst>(&I);
+      if (!CI)
+        continue;
+      llvm::Function* Callee = CI->getCalledFunction();
+      if (Callee && !Callee->isDeclaration() && Callee != F && Visiting.count(Callee) == 0)
+        Size += getInlinedSize(Callee, Sizes, Visiting);
+    }
+  }
+
+  Visiting.erase(F);
+  Sizes[F] = Size;
+  return Size;
+}
+
+// The IREmitter makes a function per guest method of the region. Every function but the entries becomes
+// internal, so once the methods are inlined (unless that would grow the entries past IPOSizeLimit) their
+// bodies can be dropped, and the constants and unused arguments of the ones left are propagated.
+void dbt::IROpt::optimizeModule(llvm::Module* M, const std::vector<uint32_t>& Entries) {
+  unsigned Defined = 0;
+  for (auto& F : *M)
+    Defined += !F.isDeclaration();
+  if (Defined < 2 || IPOSizeLimit == 0)
+    return;
+
+  std::set<std::string> Keep;
+  for (auto Entry : Entries)
+    Keep.insert("r" + std::to_string(Entry));
+
+  std::map<llvm::Function*, uint64_t> Sizes;
+  std::set<llvm::Function*> Visiting;
+  uint64_t Size = 0;
+  unsigned Calls = 0;
+  for (auto& F : *M) {
+    if (F.isDeclaration())
+      continue;
+    if (Keep.count(F.getName().str()) != 0)
+      Size += getInlinedSize(&F, Sizes, Visiting);
+    for (auto U : F.users())
+      Calls += llvm::isa<llvm::CallInst>(U);
+  }
+  bool IsToInline = Size <= IPOSizeLimit;
+
+  llvm::legacy::PassManager MPM;
+  MPM.add(llvm::createInternalizePass([&Keep](const llvm::GlobalValue& GV) {
+      return !llvm::isa<llvm::Function>(GV) || Keep.count(GV.getName().str()) != 0;
+    }));
+  if (IsToInline)
+    MPM.add(llvm::createAlwaysInlinerLegacyPass());
+  MPM.add(llvm::createIPSCCPPass());
+  MPM.add(llvm::createDeadArgEliminationPass());
+  MPM.add(llvm::createGlobalDCEPass());
+  MPM.run(*M);
+
+  IPORegions += 1;
+  if (IsToInline)
+    IPOInlined += Calls;
+  else
+    IPOOversized += 1;
+}
+
+void dbt::IROpt::dumpIPOStats() {
+  if (IPORegions != 0)
+    std::cerr << "IPO: " << IPORegions << " multi-function regions, " << IPOInlined << " calls inlined, "
+      << IPOOversized << " over the size limit\n";
+}
+
+// Guest loop headers (see IREmitter::formLoops) whose loop was vectorized
+// The vectorizer also marks loops it only interleaved (VF = 1), so a loop counts when its body has vector code
+static bool hasVectorCode(llvm::Loop* L) {
+  for (auto BB : L->blocks())
+    for (auto& I : *BB)
+      if (I.getType()->isVectorTy() || (llvm::isa<llvm::StoreInst>(I) && I.getOperand(0)->getType()->isVectorTy()))
+        return true;
+  return false;
+}
+
+std::set<uint32_t> dbt::IROpt::getVectorizedLoops(llvm::Module* M) {
+  std::set<uint32_t> Headers;
+  for (auto& F : *M) {
+    if (F.isDeclaration())
+      continue;
+
+    llvm::DominatorTree DT(F);
+    llvm::LoopInfo LI(DT);
+    for (auto& BB : F) {
+      llvm::MDNode* LoopID = BB.getTerminator() ? BB.getTerminator()->getMetadata(llvm::LLVMContext::MD_loop) : nullptr;
+      if (!LoopID)
+        continue;
+
+      bool IsVectorized = false;
+      uint32_t Header = 0;
+      for (unsigned I = 1; I < LoopID->getNumOperands(); I++) {
+        auto Hint = llvm::dyn_cast<llvm::MDNode>(LoopID->getOperand(I));
+        if (!Hint || Hint->getNumOperands() < 2)
+          continue;
+        auto Name = llvm::dyn_cast<llvm::MDString>(Hint->getOperand(0));
+        auto Value = llvm::mdconst::dyn_extract<llvm::ConstantInt>(Hint->getOperand(1));
+        if (!Name || !Value)
+          continue;
+        if (Name->getString() == "llvm.loop.isvectorized" && Value->getZExtValue() != 0)
+          IsVectorized = true;
+        else if (Name->getString() == "oi.loop.header")
+          Header = Value->getZExtValue();
+      }
+
+      llvm::Loop* L = LI.getLoopFor(&BB);
+      if (IsVectorized && Header != 0 && L != nullptr && hasVectorCode(L))
+        Headers.insert(Header);
+    }
+  }
+  return Headers;
 }
@@ -7,6 +7,7 @@
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
 
 #include "llvm/IR/CFG.h"
 
@@ -47,9 +48,12 @@ Value *dbt::IREmitter::genDataVecPtr(Value *RawAddrs, Function *Func, Type *ITyp
   Value *AddrsOff = Builder->CreateSub(RawAddrs, genImm(DataMemOffset));
   Argument *ArgDataMemPtr = &*(Func->arg_begin()+1);
   Value *MPtr8    = Builder->CreatePointerCast(ArgDataMemPtr, Type::getInt8PtrTy(TheContext));
-  Value *GEPMPtr8 = Builder->CreateGEP(MPtr8, AddrsOff);
+  // Offsets past 2GB are valid (the data window spans the guest address space), a 32-bit index would be sign extended
+  Value *GEPMPtr8 = Builder->CreateGEP(MPtr8, Builder->CreateZExt(AddrsOff, Type::getInt64Ty(TheContext)));
   Value *CastedPtr = Builder->CreatePointerCast(GEPMPtr8, Type::getIntNPtrTy(TheContext, ByteSize * 8));
   setIfNotTheFirstInstGen(AddrsOff);
+  if (IsToPartitionMemory)
+    MemPartitions[CastedPtr] = CurrentMemPartition;
   return CastedPtr;
 }
 
@@ -160,6 +164,23 @@ Value *dbt::IREmitter::genImm(uint32_t Imm) {
   return ConstantInt::get(Type::getInt32Ty(TheContext), Imm);
 }
 
+// Guest code addresses are emitted relative to "oi.reloc" when the region may be reused at another entry
+Value *dbt::IREmitter::genCodeAddr(uint32_t Addrs) {
+  if (!IsRelocatable)
+    return genImm(Addrs);
+
+  GlobalVariable* Reloc = Mod->getNamedGlobal("oi.reloc");
+  if (Reloc == nullptr) {
+    Reloc = new GlobalVariable(*Mod, Type::getInt32Ty(TheContext), false, GlobalValue::InternalLinkage,
+        cast<Constant>(genImm(0)), "oi.reloc");
+    Reloc->setExternallyInitialized(true);
+  }
+
+  Value* Delta = Builder->CreateLoad(Reloc);
+  setIfNotTheFirstInstGen(Delta);
+  return Builder->CreateAdd(Delta, genImm(Addrs));
+}
+
 Value *dbt::IREmitter::genLogicalOr(Value *Lhs, Value *Rhs, Function *Func) {
   BasicBlock *TBB = BasicBlock::Create(TheContext, "Lor.end", Func);
   BasicBlock *FBB = BasicBlock::Create(TheContext, "Lor.RHS", Func);
@@ -0,0 +1,75 @@
+#include <RFT.hpp>
+
+#include <iostream>
+
+using namespace dbt;
+
+AsyncRFT::AsyncRFT(Manager& M, std::unique_ptr<RFT> R) :
+  RFT(M), Inner(std::move(R)) {
+  Ring = std::make_unique<BranchRing<BranchEvent, 1 << 16>>();
+  Inner->setDetached(true);
+  Profiler = std::thread(&AsyncRFT::runProfiler, this);
+}
+
+AsyncRFT::~AsyncRFT() {
+  Running = false;
+  Profiler.join();
+  std::cerr << "Async RFT: " << Events << " branch events, " << Stalls << " stalls on a full ring\n";
+}
+
+void AsyncRFT::onBranch(Machine& M) {
+  uint32_t Source = M.getLastPC(), Target = M.getPC();
+
+  // The binary is handed over by the interpreter thread, the only one touching the machine
+  if (!IsBound) {
+    std::lock_guard<std::mutex> Lock(BinaryMtx);
+    BinPath   = M.getBinPath();
+    CodeStart = M.getCodeStartAddrs();
+    CodeEnd   = M.getCodeEndAddrs();
+    BinaryGen += 1;
+    IsBound = true;
+  }
+
+  if (TheManager.isNativeRegionEntry(Target))
+    M.setPC(TheManager.jumpToRegion(Target));
+
+  // Dropping events would break the paths being recorded, so the interpreter waits instead
+  BranchEvent E = {Source, Target, M.getPC()};
+  if (!Ring->push(E)) {
+    Stalls += 1;
+    while (!Ring->push(E))
+      std::this_thread::yield();
+  }
+  Events += 1;
+}
+
+void AsyncRFT::runProfiler() {
+  while (Running || !Ring->empty()) {
+    Busy = true;
+    size_t N = Ring->consume([this](const BranchEvent& E) {
+        // Only the code is loaded, the shadow never executes
+        if (ShadowGen != BinaryGen) {
+          std::lock_guard<std::mutex> Lock(BinaryMtx);
+          Shadow = std::make_unique<Machine>();
+          if (!Shadow->loadELF(BinPath, true) || Shadow->getCodeStartAddrs() != CodeStart ||
+              Shadow->getCodeEndAddrs() != CodeEnd)
+            std::cerr << "Async RFT: the code of " << BinPath << " changed since it was loaded\n";
+          ShadowGen = BinaryGen;
+        }
+
+        Shadow->setPC(E[0]);
+        Shadow->setPC(E[1]);
+        Inner->onDetachedBranch(*Shadow, E[2]);
+      }, 1024);
+    Busy = false;
+
+    if (N == 0)
+      std::this_thread::yield();
+  }
+}
+
+void AsyncRFT::reset() {
+  while (!Ring->empty() || Busy) {}
+  Inner->reset();
+  IsBound = false;
+}
@@ -25,10 +25,11 @@ void MRET2::mergePhases() {
   }
 }
 
+// Lowest slot holding a phase recorded from addr
 uint32_t MRET2::getStoredIndex(uint32_t addr) {
-  for (int i = 0; i < 1000; i++) 
-    if (stored[i].size() > 0 && stored[i][0][0] == addr) return i;
-  return 1001;
+  auto It = stored_entries.find(addr);
+  if (It == stored_entries.end()) return 1001;
+  return *It->second.begin();
 }
 
 uint32_t MRET2::getPhase(uint32_t addr) {
@@ -38,7 +39,16 @@ uint32_t MRET2::getPhase(uint32_t addr) {
 
 void MRET2::finishPhase() {
   if (getPhase(RecordingEntry) == 1) {
+    // Keep the entry -> slots index in sync with the ring of stored phases
+    if (stored[stored_index].size() > 0) {
+      auto It = stored_entries.find(stored[stored_index][0][0]);
+      It->second.erase(stored_index);
+      if (It->second.empty())
+        stored_entries.erase(It);
+    }
     stored[stored_index] = RecordingBufferTmp1;
+    if (RecordingBufferTmp1.size() > 0)
+      stored_entries[RecordingBufferTmp1[0][0]].insert(stored_index);
 
     stored_index++;
     if (stored_index == 1000) stored_index = 0;
@@ -74,7 +84,7 @@ void MRET2::onBranch(Machine& M) {
   }
 
   if (TheManager.isNativeRegionEntry(M.getPC())) {
-    auto Next = TheManager.jumpToRegion(M.getPC()); 
+    auto Next = jumpToRegion(M.getPC());
     M.setPC(Next);
 
     ++ExecFreq[M.getPC()];
@@ -0,0 +1,36 @@
+#include <RFT.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace dbt;
+
+MethodRFT::~MethodRFT() {
+  std::cerr << "Method RFT: " << Methods << " methods compiled\n";
+}
+
+void MethodRFT::formMethodRegion(uint32_t Entry, Machine& M) {
+  uint32_t End = std::min(M.getMethodEnd(Entry), M.getCodeEndAddrs());
+  if (End <= Entry)
+    return;
+
+  clearRegion();
+  RecordingEntry = Entry;
+  for (uint32_t I = Entry; I < End; I += 4)
+    appendInstruction(I, M.getInstAt(I).asI_);
+
+  if (finishRegionFormation())
+    Methods += 1;
+}
+
+void MethodRFT::onBranch(Machine &M) {
+  uint32_t PC = M.getPC();
+
+  if (M.isMethodEntry(PC) && !TheManager.isRegionEntry(PC) && AlreadyCompiled.count(PC) == 0) {
+    if ((IsEager || ++ExecFreq[PC] > HotnessThreshold) && isAllowedInstToStart(PC, M))
+      formMethodRegion(PC, M);
+  }
+
+  if (TheManager.isNativeRegionEntry(M.getPC()))
+    M.setPC(jumpToRegion(M.getPC()));
+}
@@ -141,7 +141,7 @@ void NETPlus::onBranch(Machine& M) {
         expandAndFinish(M);
         break;
       }
-      OIRegion.push_back({I, M.getInstAt(I).asI_});
+      appendInstruction(I, M.getInstAt(I).asI_);
     }
 
     if (TheManager.isNativeRegionEntry(M.getPC())) 
@@ -154,7 +154,7 @@ void NETPlus::onBranch(Machine& M) {
   }
 
   if (TheManager.isNativeRegionEntry(M.getPC())) {
-    auto Next = TheManager.jumpToRegion(M.getPC()); 
+    auto Next = jumpToRegion(M.getPC());
     M.setPC(Next);
 
     ++ExecFreq[Next];
@@ -6,7 +6,7 @@ using namespace dbt;
 
 void PreheatRFT::onBranch(Machine &M) {
   if (TheManager.isNativeRegionEntry(M.getPC())) {
-    auto Next = TheManager.jumpToRegion(M.getPC()); 
+    auto Next = jumpToRegion(M.getPC());
     M.setPC(Next);
   } 
 }
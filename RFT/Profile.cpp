@@ -0,0 +1,15 @@
+#include <RFT.hpp>
+
+using namespace dbt;
+
+void ProfileRFT::onBranch(Machine& M) {
+  Profile.addBranch(M.getPC());
+
+  Inner.onBranch(M);
+}
+
+void ProfileRFT::onIndirectBranch(Machine& M) {
+  Profile.addIndirectBranch(M.getLastPC(), M.getPC());
+
+  Inner.onIndirectBranch(M);
+}
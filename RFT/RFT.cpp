@@ -7,13 +7,27 @@
 unsigned Total = 0;
 void dbt::RFT::insertInstruction(uint32_t Addrs, uint32_t Opcode) {
   if (!hasRecordedAddrs(Addrs))
-    OIRegion.push_back({Addrs, Opcode});
+    appendInstruction(Addrs, Opcode);
+}
+
+void dbt::RFT::appendInstruction(uint32_t Addrs, uint32_t Opcode) {
+  OIRegion.push_back({Addrs, Opcode});
+  RecordedAddrs.insert(Addrs);
+}
+
+void dbt::RFT::clearRegion() {
+  OIRegion.clear();
+  RecordedAddrs.clear();
 }
 
 void dbt::RFT::insertInstruction(std::array<uint32_t, 2>& Inst) {
   insertInstruction(Inst[0], Inst[1]);
 }
 
+uint32_t dbt::RFT::jumpToRegion(uint32_t Entry) {
+  return IsDetached ? DetachedExit : TheManager.jumpToRegion(Entry);
+}
+
 bool dbt::RFT::isBackwardLoop(uint32_t PC) {
   return OIRegion.size() == 0 ? false : PC < OIRegion.back()[0];  
 }
@@ -23,30 +37,112 @@ void dbt::RFT::startRegionFormation(uint32_t PC) {
   if (TheManager.getNumOfOIRegions() == 0) {
     Recording = true;
     RecordingEntry = PC;
-    OIRegion.clear();
+    clearRegion();
     ExecFreq[PC] = 0;
   }
 }
 
 bool dbt::RFT::hasRecordedAddrs(uint32_t Addrs) {
-  for (auto I : OIRegion){
-    if (I[0] == Addrs) 
-      return true;
+  return RecordedAddrs.count(Addrs) != 0;
+}
+
+// Rough number of LLVM instructions the IREmitter generates for an OI instruction (before optimization)
+unsigned dbt::RFT::estimateIRSize(uint32_t Opcode) {
+  OIDecoder::OIInst I = OIDecoder::decode(Opcode);
+  switch (I.Type) {
+    case Ldw: case Ldh: case Ldhu: case Ldb: case Ldbu: case Ldc1: case Lwc1: case Ldxc1: case Lwxc1:
+    case Stw: case Sth: case Stb: case Sdc1: case Swc1: case Sdxc1: case Swxc1:
+      return 6;
+    case Call: case Callr: case Jumpr: case Ijmp: case Syscall:
+      return 10;
+    default:
+      return OIDecoder::isControlFlowInst(I) ? 4 : 3;
+  }
+}
+
+bool dbt::RFT::isOversized(const OIInstList& Region) {
+  if (RegionLimitSize != 0 && Region.size() > RegionLimitSize)
+    return true;
+
+  if (RegionLimitIRSize != 0) {
+    unsigned IRSize = 0;
+    for (auto I : Region)
+      IRSize += estimateIRSize(I[1]);
+    return IRSize > RegionLimitIRSize;
   }
   return false;
 }
 
+static bool isAllowedToStart(uint32_t Opcode) {
+  auto Type = dbt::OIDecoder::decode(Opcode).Type;
+  return !(Type == Syscall || Type == Ijmp || Type == Callr);
+}
+
+// Cuts the recording (in recorded order) in parts under the limits, preferably right after a branch: the
+// next part then starts at a target the previous one exits to, so the regions chain in jumpToRegion
+std::vector<OIInstList> dbt::RFT::splitRegion(const OIInstList& Region) {
+  std::vector<OIInstList> Parts;
+  OIInstList Current;
+  unsigned CurrentIRSize = 0;
+
+  for (auto Inst : Region) {
+    Current.push_back(Inst);
+    CurrentIRSize += estimateIRSize(Inst[1]);
+
+    bool Full = (RegionLimitSize != 0 && Current.size() >= RegionLimitSize) ||
+                (RegionLimitIRSize != 0 && CurrentIRSize >= RegionLimitIRSize);
+    if (!Full)
+      continue;
+
+    size_t Cut = Current.size();
+    for (size_t I = Current.size(); I > Current.size() / 2; I--) {
+      if (OIDecoder::isControlFlowInst(OIDecoder::decode(Current[I-1][1]))) {
+        Cut = I;
+        break;
+      }
+    }
+    while (Cut < Current.size() && !isAllowedToStart(Current[Cut][1]))
+      Cut++;
+
+    Parts.push_back(OIInstList(Current.begin(), Current.begin() + Cut));
+    Current.erase(Current.begin(), Current.begin() + Cut);
+
+    CurrentIRSize = 0;
+    for (auto I : Current)
+      CurrentIRSize += estimateIRSize(I[1]);
+  }
+
+  if (!Current.empty())
+    Parts.push_back(Current);
+  return Parts;
+}
+
 bool dbt::RFT::finishRegionFormation() {
   bool Added = false;
 
   if (OIRegion.size() != 0 && hasRecordedAddrs(RecordingEntry) && AlreadyCompiled.count(RecordingEntry) == 0) {
-    Added = TheManager.addOIRegion(RecordingEntry, OIRegion);
-    if (Added) {
-      Total += OIRegion.size();
-      AlreadyCompiled.insert(RecordingEntry);
+    if (isOversized(OIRegion)) {
+      for (auto& Part : splitRegion(OIRegion)) {
+        bool HasEntry = false;
+        for (auto I : Part)
+          HasEntry |= I[0] == RecordingEntry;
+
+        uint32_t Entry = HasEntry ? RecordingEntry : Part[0][0];
+        if (AlreadyCompiled.count(Entry) == 0 && TheManager.addOIRegion(Entry, Part)) {
+          Total += Part.size();
+          AlreadyCompiled.insert(Entry);
+          Added |= HasEntry;
+        }
+      }
+    } else {
+      Added = TheManager.addOIRegion(RecordingEntry, OIRegion);
+      if (Added) {
+        Total += OIRegion.size();
+        AlreadyCompiled.insert(RecordingEntry);
+      }
     }
   }
-  OIRegion.clear();
+  clearRegion();
   Recording = false;
   return Added;
 }
@@ -73,3 +169,35 @@ bool dbt::RFT::isAllowedInstToStart(unsigned Addr, Machine& M) {
     auto I = OIDecoder::decode(M.getInstAt(Addr).asI_);
     return !(I.Type == Syscall || I.Type == Ijmp || I.Type == Callr);
 }
+
+std::unique_ptr<dbt::RFT> dbt::RFT::create(std::string Name, Manager& TheManager) {
+  if (Name == "net") {
+    std::cerr << "NET RFT Selected\n";
+    return std::make_unique<dbt::NET>(TheManager);
+  } else if (Name == "net-r") {
+    std::cerr << "NET-R RFT Selected\n";
+    return std::make_unique<dbt::NET>(TheManager, true);
+  } else if (Name == "mret2") {
+    std::cerr << "MRET2 RFT Selected\n";
+    return std::make_unique<dbt::MRET2>(TheManager);
+  } else if (Name == "netplus") {
+    std::cerr << "NETPlus RFT Selected\n";
+    return std::make_unique<dbt::NETPlus>(TheManager);
+  } else if (Name == "netplus-c") {
+    std::cerr << "NETPlus-c RFT Selected\n";
+    return std::make_unique<dbt::NETPlus>(TheManager, false, true);
+  } else if (Name == "netplus-e-r") {
+    std::cerr << "NETPlus-e-r RFT Selected\n";
+    return std::make_unique<dbt::NETPlus>(TheManager, true);
+  } else if (Name == "netplus-e-r-c") {
+    std::cerr << "NETPlus-e-r-c RFT Selected\n";
+    return std::make_unique<dbt::NETPlus>(TheManager, true, true);
+  } else if (Name == "method") {
+    std::cerr << "Method RFT Selected\n";
+    return std::make_unique<dbt::MethodRFT>(TheManager);
+  } else if (Name == "method-eager") {
+    std::cerr << "Method-eager RFT Selected\n";
+    return std::make_unique<dbt::MethodRFT>(TheManager, true);
+  }
+  return nullptr;
+}
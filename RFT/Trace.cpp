@@ -0,0 +1,7 @@
+#include <RFT.hpp>
+
+using namespace dbt;
+
+void TraceRFT::onBranch(Machine &M) {
+  Writer.add(M.getLastPC(), M.getPC());
+}
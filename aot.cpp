@@ -0,0 +1,191 @@
+#include <aot.hpp>
+#include <IREmitter.hpp>
+#include <IROpt.hpp>
+#include <manager.hpp>
+#include <regionCache.hpp>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace dbt;
+
+uint64_t AOTCompiler::hashBinary(Machine& M) {
+  uint32_t Offset = M.getDataMemOffset();
+  uint64_t Hash = RegionCache::hashBytes(&Offset, sizeof(Offset));
+  for (uint32_t Addrs = M.getCodeStartAddrs(); Addrs < M.getCodeEndAddrs(); Addrs += 4) {
+    uint32_t Word = M.getInstAt(Addrs).asI_;
+    Hash = RegionCache::hashBytes(&Word, sizeof(Word), Hash);
+  }
+  return Hash;
+}
+
+std::vector<std::pair<uint32_t, OIInstList>> AOTCompiler::readProfile(std::string Path) {
+  if (Path.back() != '/')
+    Path += '/';
+
+  std::vector<std::pair<uint32_t, OIInstList>> Regions;
+  std::ifstream Order(Path + "regions.order");
+  std::string Line;
+  while (std::getline(Order, Line)) {
+    uint32_t Entry = std::stoi(Line);
+    std::ifstream File(Path + "r" + std::to_string(Entry) + ".oi");
+    OIInstList Insts;
+    while (std::getline(File, Line)) {
+      std::istringstream ISS(Line);
+      uint32_t Addrs, Opcode;
+      if (!(ISS >> Addrs >> Opcode))
+        break;
+      Insts.push_back({Addrs, Opcode});
+    }
+    if (!Insts.empty())
+      Regions.push_back({Entry, Insts});
+  }
+  return Regions;
+}
+
+bool AOTCompiler::compile(Machine& M, std::vector<std::pair<uint32_t, OIInstList>>& Regions, std::string Path, bool Verbose) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+
+  std::unique_ptr<llvm::TargetMachine> TM(llvm::EngineBuilder().setRelocationModel(llvm::Reloc::PIC_).selectTarget());
+
+  IREmitter IRE;
+  IROpt IRO;
+  IRO.setTargetMachine(TM.get());
+  llvm::LLVMContext& C = IRE.getContext();
+
+  // Every region is native from the start, so calls between methods are emitted as direct calls and bound
+  // by the linker
+  uint64_t* Native = static_cast<uint64_t*>(calloc(NATIVE_REGION_SIZE, sizeof(uint64_t)));
+  for (auto& R : Regions)
+    if (R.first < NATIVE_REGION_SIZE)
+      Native[R.first] = 1;
+
+  auto All = llvm::make_unique<llvm::Module>("oi.aot", C);
+  All->setDataLayout(TM->createDataLayout());
+  All->setTargetTriple(TM->getTargetTriple().str());
+  llvm::Linker L(*All);
+
+  std::vector<uint32_t> Entries;
+  for (auto& R : Regions) {
+    if (R.first >= NATIVE_REGION_SIZE || All->getFunction("r" + std::to_string(R.first)) != nullptr)
+      continue;
+
+    if (Verbose)
+      std::cerr << "AOT: translating " << std::hex << R.first << std::dec << " (" << R.second.size() << " OI insts)\n";
+
+    auto Mod = llvm::make_unique<llvm::Module>("r" + std::to_string(R.first), C);
+    IRE.generateRegionIR({R.first}, R.second, M.getDataMemOffset(), M, *TM, Native, Mod.get());
+
+    // Methods inlined in a region are private copies, only the region entry is exported
+    std::string Name = "r" + std::to_string(R.first);
+    for (auto& F : *Mod)
+      if (!F.isDeclaration() && F.getName() != Name)
+        F.setLinkage(llvm::GlobalValue::InternalLinkage);
+
+    if (L.linkInModule(std::move(Mod))) {
+      std::cerr << "AOT: can't link region " << R.first << "\n";
+      continue;
+    }
+    Entries.push_back(R.first);
+  }
+  free(Native);
+
+  // Direct calls to methods that weren't translated leave to the interpreter at the callee
+  for (auto& F : *All) {
+    uint32_t Addrs;
+    if (F.isDeclaration() && F.getName().startswith("r") && !F.getName().drop_front(1).getAsInteger(10, Addrs)) {
+      llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(C, "entry", &F));
+      Builder.CreateRet(llvm::ConstantInt::get(llvm::Type::getInt32Ty(C), Addrs));
+    }
+  }
+
+  IRO.optimizeIRFunction(All.get(), IROpt::OptLevel::Basic, 0, 1, M.getBinPath());
+
+  llvm::Type* I32 = llvm::Type::getInt32Ty(C);
+  llvm::Type* I8Ptr = llvm::Type::getInt8PtrTy(C);
+  llvm::StructType* EntryTy = llvm::StructType::get(C, {I32, I8Ptr});
+
+  std::vector<llvm::Constant*> Table;
+  for (auto E : Entries) {
+    llvm::Function* F = All->getFunction("r" + std::to_string(E));
+    if (F == nullptr || F->isDeclaration() || IREmitter::isSelfReturning(F, E))
+      continue;
+    Table.push_back(llvm::ConstantStruct::get(EntryTy, {llvm::ConstantInt::get(I32, E), llvm::ConstantExpr::getBitCast(F, I8Ptr)}));
+  }
+
+  llvm::ArrayType* TableTy = llvm::ArrayType::get(EntryTy, Table.size());
+  new llvm::GlobalVariable(*All, TableTy, true, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantArray::get(TableTy, Table), "oi_aot_entries");
+  new llvm::GlobalVariable(*All, I32, true, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantInt::get(I32, Table.size()), "oi_aot_count");
+  new llvm::GlobalVariable(*All, llvm::Type::getInt64Ty(C), true, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantInt::get(llvm::Type::getInt64Ty(C), hashBinary(M)), "oi_aot_hash");
+
+  std::string ObjPath = Path + ".o";
+  std::error_code EC;
+  llvm::raw_fd_ostream Obj(ObjPath, EC, llvm::sys::fs::F_None);
+  if (EC) {
+    std::cerr << "Can't write " << ObjPath << "\n";
+    return false;
+  }
+
+  llvm::legacy::PassManager PM;
+  if (TM->addPassesToEmitFile(PM, Obj, nullptr, llvm::TargetMachine::CGFT_ObjectFile)) {
+    std::cerr << "The target can't emit object files\n";
+    return false;
+  }
+  PM.run(*All);
+  Obj.close();
+
+  std::string Cmd = "cc -shared -o '" + Path + "' '" + ObjPath + "'";
+  int Status = std::system(Cmd.c_str());
+  std::remove(ObjPath.c_str());
+  if (Status != 0) {
+    std::cerr << "Linking " << Path << " failed\n";
+    return false;
+  }
+
+  std::cerr << "AOT: " << Table.size() << " regions written to " << Path << "\n";
+  return true;
+}
+
+std::unordered_map<uint32_t, uint64_t> AOTCompiler::load(std::string Path, Machine& M) {
+  std::unordered_map<uint32_t, uint64_t> Natives;
+
+  // Undefined symbols (intrinsics, in-region syscalls) resolve against the oi-dbt executable. The entries
+  // stay local to the handle, JIT regions reach them through the addresses in NativeRegions.
+  void* Handle = dlopen(Path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (Handle == nullptr) {
+    std::cerr << "Can't load " << Path << ": " << dlerror() << "\n";
+    return Natives;
+  }
+
+  auto Hash  = static_cast<uint64_t*>(dlsym(Handle, "oi_aot_hash"));
+  auto Count = static_cast<uint32_t*>(dlsym(Handle, "oi_aot_count"));
+  auto Table = static_cast<Entry*>(dlsym(Handle, "oi_aot_entries"));
+  if (Hash == nullptr || Count == nullptr || Table == nullptr || *Hash != hashBinary(M)) {
+    std::cerr << Path << " wasn't translated from " << M.getBinPath() << ", ignoring it\n";
+    dlclose(Handle);
+    return Natives;
+  }
+
+  for (uint32_t I = 0; I < *Count; I++)
+    Natives[Table[I].Addrs] = reinterpret_cast<uint64_t>(Table[I].Fn);
+  return Natives;
+}
@@ -0,0 +1,210 @@
+#include <autotuner.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace dbt;
+
+Autotuner::Autotuner(std::string P, unsigned Max, std::vector<std::string> Default) : Path(P), MaxRegions(Max) {
+  Candidates = {
+    Default,
+    {"instcombine", "simplifycfg", "gvn", "dce"},
+    {"instcombine", "simplifycfg", "reassociate", "gvn", "licm", "memcpyopt", "loop-unswitch", "licm",
+      "instcombine", "indvars", "loop-deletion", "instcombine", "gvn", "dce"},
+    {"sroa", "instcombine", "simplifycfg", "reassociate", "gvn", "licm", "loop-rotate", "licm", "indvars",
+      "loop-unroll", "instcombine", "simplifycfg", "gvn", "dce"},
+    {"sroa", "instcombine", "simplifycfg", "reassociate", "gvn", "die", "dce", "instcombine", "licm",
+      "memcpyopt", "loop-rotate", "licm", "instcombine", "indvars", "loop-deletion", "loop-vectorize",
+      "slp-vectorizer", "instcombine", "simplifycfg", "licm", "gvn"}
+  };
+}
+
+void Autotuner::setBinary(uint64_t Hash) {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  if (HasBinary && Hash == Binary)
+    return;
+
+  Calls.clear();
+  FirstPasses.clear();
+  Tuning.clear();
+  Jobs.clear();
+  NumOfJobs = 0;
+  Binary = Hash;
+  HasBinary = true;
+  NumDone = 0;
+  Sampling = MaxRegions != 0;
+
+  std::ostringstream Name;
+  Name << Path << "." << std::hex << Hash;
+  BinaryPath = Name.str();
+
+  // Regions tuned by previous runs keep their passes and aren't tuned again
+  Best.clear();
+  std::ifstream File(BinaryPath);
+  std::string Line;
+  while (std::getline(File, Line)) {
+    std::istringstream ISS(Line);
+    uint32_t Entry;
+    std::string Pass;
+    if (!(ISS >> Entry))
+      continue;
+    while (ISS >> Pass)
+      Best[Entry].push_back(Pass);
+  }
+}
+
+void Autotuner::pushJob(uint32_t Entry, unsigned Candidate) {
+  Tuning[Entry].Pending = true;
+  Jobs.push_back({Entry, Candidate});
+  NumOfJobs += 1;
+}
+
+bool Autotuner::addSample(uint32_t Entry, uint64_t Cycles) {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+
+  auto It = Tuning.find(Entry);
+  if (It == Tuning.end()) {
+    if (!HasBinary || Tuning.size() >= MaxRegions || Best.count(Entry) != 0 || ++Calls[Entry] < HotCalls)
+      return false;
+
+    // The running code is the first candidate measured
+    State& S = Tuning[Entry];
+    S.Costs.resize(Candidates.size());
+    auto First = FirstPasses.find(Entry);
+    S.First = First != FirstPasses.end() ? First->second : Candidates[0];
+    return false;
+  }
+
+  State& S = It->second;
+  if (S.Pending || S.Done)
+    return false;
+
+  // The first executions after an install pay for cold caches
+  if (S.Skip != 0) {
+    S.Skip -= 1;
+    return false;
+  }
+
+  S.Calls += 1;
+  S.Cycles += Cycles;
+  if (S.Calls < MeasureCalls)
+    return false;
+
+  S.Costs[S.Current] = (double) S.Cycles / S.Calls;
+  if (S.Current + 1 < Candidates.size()) {
+    pushJob(Entry, S.Current + 1);
+    return true;
+  }
+
+  unsigned Winner = std::min_element(S.Costs.begin(), S.Costs.end()) - S.Costs.begin();
+  Best[Entry] = Winner == 0 ? S.First : Candidates[Winner];
+  S.Done = true;
+  if (++NumDone >= MaxRegions)
+    Sampling = false;
+  if (Winner != 0)
+    Improved += 1;
+  write();
+
+  if (Winner != S.Current) {
+    pushJob(Entry, Winner);
+    return true;
+  }
+  return false;
+}
+
+bool Autotuner::takeJob(Job& J) {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  if (Jobs.empty())
+    return false;
+
+  J = Jobs.front();
+  Jobs.pop_front();
+  NumOfJobs -= 1;
+  Busy = true;
+  return true;
+}
+
+std::vector<std::string> Autotuner::getPasses(const Job& J) {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  auto It = Tuning.find(J.Entry);
+  if (J.Candidate == 0 && It != Tuning.end())
+    return It->second.First;
+  return Candidates[J.Candidate];
+}
+
+void Autotuner::setFirstPasses(uint32_t Entry, const std::vector<std::string>& Passes) {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  FirstPasses[Entry] = Passes;
+}
+
+void Autotuner::setInstalled(uint32_t Entry, unsigned Candidate) {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  auto It = Tuning.find(Entry);
+  if (It == Tuning.end())
+    return;
+
+  State& S = It->second;
+  S.Current = Candidate;
+  S.Skip = 16;
+  S.Calls = S.Cycles = 0;
+  S.Pending = false;
+  Compiled += 1;
+}
+
+bool Autotuner::getBest(uint32_t Entry, std::vector<std::string>& Passes) {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  auto It = Best.find(Entry);
+  if (It == Best.end())
+    return false;
+  Passes = It->second;
+  return true;
+}
+
+void Autotuner::reset() {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  Calls.clear();
+  FirstPasses.clear();
+  Jobs.clear();
+  NumOfJobs = 0;
+  for (auto It = Tuning.begin(); It != Tuning.end();) {
+    if (It->second.Done)
+      ++It;
+    else
+      It = Tuning.erase(It);
+  }
+}
+
+bool Autotuner::write() {
+  std::string TmpPath = BinaryPath + "." + std::to_string(getpid());
+  std::ofstream File(TmpPath);
+  if (!File.is_open()) {
+    std::cerr << "Can't write the tuned opts " << TmpPath << "\n";
+    return false;
+  }
+
+  std::map<uint32_t, std::vector<std::string>> Sorted(Best.begin(), Best.end());
+  for (auto& B : Sorted) {
+    File << B.first;
+    for (auto& Pass : B.second)
+      File << " " << Pass;
+    File << "\n";
+  }
+  File.close();
+  return std::rename(TmpPath.c_str(), BinaryPath.c_str()) == 0;
+}
+
+void Autotuner::dumpStats() {
+  std::lock_guard<std::mutex> Lock(TunerMtx);
+  unsigned Done = 0;
+  for (auto& T : Tuning)
+    Done += T.second.Done;
+  std::cerr << "Autotuner: " << Done << " regions tuned (" << Improved << " improved), " << Compiled
+    << " candidates compiled";
+  if (HasBinary)
+    std::cerr << ", winners in " << BinaryPath;
+  std::cerr << "\n";
+}
@@ -0,0 +1,112 @@
+#include <branchTrace.hpp>
+
+#include <iostream>
+
+using namespace dbt;
+
+#define TRACE_BUFFER_SIZE (64 * 1024)
+#define TRACE_MAGIC "OIBT1"
+
+static uint64_t zigzag(int64_t V) {
+  return (static_cast<uint64_t>(V) << 1) ^ static_cast<uint64_t>(V >> 63);
+}
+
+static int64_t unzigzag(uint64_t V) {
+  return static_cast<int64_t>(V >> 1) ^ -static_cast<int64_t>(V & 1);
+}
+
+BranchTraceWriter::BranchTraceWriter(std::string Path) {
+  File = gzopen(Path.c_str(), "wb6");
+  if (File == nullptr) {
+    std::cerr << "Can't open the branch trace " << Path << "\n";
+    exit(1);
+  }
+  gzwrite(File, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  Buffer.reserve(TRACE_BUFFER_SIZE + 32);
+}
+
+BranchTraceWriter::~BranchTraceWriter() {
+  flush();
+  gzclose(File);
+}
+
+void BranchTraceWriter::flush() {
+  if (!Buffer.empty())
+    gzwrite(File, Buffer.data(), Buffer.size());
+  Buffer.clear();
+}
+
+void BranchTraceWriter::putVarint(int64_t V) {
+  uint64_t U = zigzag(V);
+  while (U >= 0x80) {
+    Buffer.push_back(static_cast<uint8_t>(U) | 0x80);
+    U >>= 7;
+  }
+  Buffer.push_back(static_cast<uint8_t>(U));
+}
+
+void BranchTraceWriter::add(uint32_t Source, uint32_t Target) {
+  putVarint(static_cast<int64_t>(Source) - LastTarget);
+  putVarint(static_cast<int64_t>(Target) - Source);
+  LastTarget = Target;
+  Events += 1;
+
+  if (Buffer.size() >= TRACE_BUFFER_SIZE)
+    flush();
+}
+
+BranchTraceReader::BranchTraceReader(std::string Path) {
+  File = gzopen(Path.c_str(), "rb");
+  if (File == nullptr)
+    return;
+
+  char Magic[sizeof(TRACE_MAGIC)];
+  if (gzread(File, Magic, sizeof(Magic)) != sizeof(Magic) || std::string(Magic) != TRACE_MAGIC) {
+    gzclose(File);
+    File = nullptr;
+  }
+}
+
+BranchTraceReader::~BranchTraceReader() {
+  if (File != nullptr)
+    gzclose(File);
+}
+
+bool BranchTraceReader::getByte(uint8_t& B) {
+  if (Pos == Buffer.size()) {
+    Buffer.resize(TRACE_BUFFER_SIZE);
+    int Read = gzread(File, Buffer.data(), TRACE_BUFFER_SIZE);
+    Buffer.resize(Read > 0 ? Read : 0);
+    Pos = 0;
+    if (Buffer.empty())
+      return false;
+  }
+  B = Buffer[Pos++];
+  return true;
+}
+
+bool BranchTraceReader::getVarint(int64_t& V) {
+  uint64_t U = 0;
+  uint8_t B;
+  for (unsigned Shift = 0; Shift < 64; Shift += 7) {
+    if (!getByte(B))
+      return false;
+    U |= static_cast<uint64_t>(B & 0x7F) << Shift;
+    if ((B & 0x80) == 0) {
+      V = unzigzag(U);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BranchTraceReader::next(uint32_t& Source, uint32_t& Target) {
+  int64_t SourceDelta, TargetDelta;
+  if (!getVarint(SourceDelta) || !getVarint(TargetDelta))
+    return false;
+
+  Source = LastTarget + SourceDelta;
+  Target = Source + TargetDelta;
+  LastTarget = Target;
+  return true;
+}
@@ -26,6 +26,7 @@
 #include <unordered_map>
 #include <memory>
 #include <set>
+#include <map>
 
 #define __STDC_CONSTANT_MACROS // llvm complains otherwise
 #define __STDC_LIMIT_MACROS
@@ -78,7 +79,48 @@ namespace dbt {
 
     void setIfNotTheFirstInstGen(llvm::Value*);
 
+    bool isIntrinsicCall(uint32_t, dbt::OIDecoder::OIInst);
+
+    struct LoopIdiom {
+      uint32_t Header, Latch;
+      bool IsCopy;
+      dbt::OIDecoder::OIInst Load, Store, Branch;
+      uint32_t LoadAddrs, StoreAddrs;
+      uint16_t Counter, End;
+      std::map<uint16_t, std::pair<int32_t, uint32_t>> Inductions; // Reg -> (Step, Addi address)
+    };
+
+    bool IsToEmitLoopIdioms = false;
+    spp::sparse_hash_map<uint32_t, LoopIdiom> LoopIdioms;
+    spp::sparse_hash_map<uint32_t, llvm::BasicBlock*> LoopIdiomBodies;
+    std::vector<std::pair<llvm::BranchInst*, uint32_t>> LoopIdiomExits;
+
+    void findLoopIdioms(const OIInstList&);
+    void genLoopIdiom(uint32_t, llvm::Function*);
+    void processLoopIdiomExits();
+
+    bool IsToEmitLoopMetadata = false;
+    void formLoops(llvm::Function*);
+
+    enum MemPartition {
+      Register, Stack, Global, Unknown
+    };
+
+    bool IsToEmitInRegionSyscalls = false;
+
+    bool IsToPartitionMemory = false;
+    bool HasStackPartition = false, HasGlobalPartition = false;
+    uint32_t StackAdjustment = 0;
+    MemPartition CurrentMemPartition = MemPartition::Unknown;
+    spp::sparse_hash_map<llvm::Value*, MemPartition> MemPartitions;
+
+    void findMemoryPartitions(const OIInstList&);
+    MemPartition getMemPartition(dbt::OIDecoder::OIInst);
+    void tagMemoryPartitions(llvm::Function*);
+    void versionMemoryPartitions(llvm::Function*);
+
     void cleanCFG();
+    llvm::BasicBlock* getTargetBlock(uint32_t, llvm::Function*);
     void updateBranchTarget(uint32_t, std::array<uint32_t, 2>);
     void improveIndirectBranch(uint32_t, uint32_t);
     void processBranchesTargets(const OIInstList&);
@@ -93,6 +135,9 @@ namespace dbt {
     llvm::Value* genRegisterVecPtr(llvm::Value*, llvm::Function*, RegType);
 
     llvm::Value* genImm(uint32_t);
+    llvm::Value* genCodeAddr(uint32_t);
+
+    bool IsRelocatable = false;
 
     llvm::Value* genLoadRegister(uint16_t, llvm::Function*, RegType Type = RegType::Int);
     llvm::Value* genStoreRegister(uint16_t, llvm::Value*, llvm::Function*, RegType Type = RegType::Int);
@@ -114,6 +159,40 @@ namespace dbt {
     void generateRegionIR(std::vector<uint32_t>, OIInstList&, uint32_t, dbt::Machine&,
         llvm::TargetMachine&, volatile uint64_t* NativeRegions, llvm::Module*);
 
+    void setRelocatable(bool R) {
+      IsRelocatable = R;
+    }
+
+    void setLoopIdioms(bool E) {
+      IsToEmitLoopIdioms = E;
+    }
+
+    void setLoopMetadata(bool E) {
+      IsToEmitLoopMetadata = E;
+    }
+
+    void setMemoryPartitions(bool E) {
+      IsToPartitionMemory = E;
+    }
+
+    void setInRegionSyscalls(bool E) {
+      IsToEmitInRegionSyscalls = E;
+    }
+
+    llvm::LLVMContext& getContext() {
+      return TheContext;
+    }
+
+    // Regions whose entry returns straight away (to themselves or to an unknown target) loop forever in
+    // jumpToRegion and aren't installed
+    static bool isSelfReturning(llvm::Function* F, uint32_t Entry) {
+      auto Ret = llvm::dyn_cast<llvm::ReturnInst>(F->getEntryBlock().getFirstNonPHI());
+      if (Ret == nullptr)
+        return false;
+      auto Const = llvm::dyn_cast<llvm::ConstantInt>(Ret->getReturnValue());
+      return Const == nullptr || Const->equalsInt(Entry);
+    }
+
     static size_t getAssemblySize(const void* func) {
       char outline[1024];
       size_t Size = 0;
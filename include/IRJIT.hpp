@@ -55,11 +55,28 @@ private:
 
   IRTransformLayer<decltype(CompileLayer), OptimizeFunction> OptimizeLayer;
 
+  volatile uint64_t* NativeRegions = nullptr;
+  uint64_t NativeRegionsSize = 0;
+
+  // r<addr> names a guest method: the region installed for it now wins over older modules defining the name
+  JITSymbol findNativeRegion(const std::string &Name) {
+    StringRef Guest(Name);
+    if (DL.getGlobalPrefix() != '\0')
+      Guest = Guest.drop_front(1);
+    uint64_t Entry;
+    if (NativeRegions == nullptr || !Guest.startswith("r") || Guest.drop_front(1).getAsInteger(10, Entry) ||
+        Entry >= NativeRegionsSize || NativeRegions[Entry] <= 1)
+      return nullptr;
+    return JITSymbol(NativeRegions[Entry], JITSymbolFlags::Exported);
+  }
+
 public:
   IRJIT()
       : Resolver(createLegacyLookupResolver(
             ES,
             [this](const std::string &Name) -> JITSymbol {
+              if (auto Sym = findNativeRegion(Name))
+                return Sym;
               if (auto Sym = OptimizeLayer.findSymbol(Name, false))
                 return Sym;
               else if (auto Err = Sym.takeError())
@@ -85,6 +102,13 @@ public:
 
   TargetMachine &getTargetMachine() { return *TM; }
 
+  // Direct calls between regions are emitted by name and bound here when their module is linked, so the
+  // IR never holds addresses of this process (it is dumped, archived and reloaded elsewhere)
+  void setNativeRegions(volatile uint64_t* NR, uint64_t Size) {
+    NativeRegions = NR;
+    NativeRegionsSize = Size;
+  }
+
   VModuleKey addModule(std::unique_ptr<Module> M) {
     // Add the module to the JIT with a new VModuleKey.
     auto K = ES.allocateVModule();
@@ -92,6 +116,13 @@ public:
     return K;
   }
 
+  // Object files compiled elsewhere (see Manager::compileInParallel), their symbols resolve against each other
+  VModuleKey addObject(std::unique_ptr<MemoryBuffer> Obj) {
+    auto K = ES.allocateVModule();
+    cantFail(ObjectLayer.addObject(K, std::move(Obj)));
+    return K;
+  }
+
   JITSymbol findSymbol(const std::string Name) {
     std::string MangledName;
     raw_string_ostream MangledNameStream(MangledName);
@@ -99,6 +130,14 @@ public:
     return OptimizeLayer.findSymbol(MangledNameStream.str(), true);
   }
 
+  // An object may share symbol names with earlier stubs, so its own definitions are looked up in it
+  JITSymbol findSymbolIn(VModuleKey K, const std::string Name) {
+    std::string MangledName;
+    raw_string_ostream MangledNameStream(MangledName);
+    Mangler::getNameWithPrefix(MangledNameStream, Name, DL);
+    return ObjectLayer.findSymbolIn(K, MangledNameStream.str(), true);
+  }
+
   void removeModule(VModuleKey K) {
     cantFail(OptimizeLayer.removeModule(K));
   }
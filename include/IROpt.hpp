@@ -3,16 +3,49 @@
 
 #include "llvm/IR/Module.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <set>
+#include <string>
+#include <vector>
 
 namespace dbt {
 	class IROpt {
     std::unique_ptr<llvm::legacy::FunctionPassManager> BasicPM;
+    std::unique_ptr<llvm::legacy::FunctionPassManager> VectorPM;
+
+    llvm::TargetMachine* TM = nullptr;
 
+    void addPass(llvm::legacy::FunctionPassManager*, std::string);
     void populateFuncPassManager(llvm::legacy::FunctionPassManager*, std::vector<std::string>);
+    void runTimedPasses(llvm::Module*, const std::vector<std::string>&);
   public:
     IROpt() {}; 
 
-    enum OptLevel { Basic, Soft, Medium, Hard, Custom };
+    enum OptLevel { Basic, Soft, Medium, Hard, Vector, Custom };
+
+    void setTargetMachine(llvm::TargetMachine* T) { TM = T; };
+
+    static std::set<uint32_t> getVectorizedLoops(llvm::Module*);
+
+    // Time every pass (dumpPassStats); a budget (ms per region) also drops the passes predicted to overrun it
+    static void setPassTiming(bool);
+    static void setCompileBudget(double);
+    static double getCompileBudget();
+    static bool isTimingPasses();
+    static void dumpPassStats();
+
+    // Names understood by addPass (any other makes it exit)
+    static bool isKnownPass(const std::string&);
+
+    // Passes run by optimizeIRFunction at Basic and Vector levels
+    static std::vector<std::string> getPassList(OptLevel);
+
+    // Module stage for regions with more than one function, the given entries are kept
+    void optimizeModule(llvm::Module*, const std::vector<uint32_t>&);
+    static void setIPOSizeLimit(unsigned);
+    static unsigned getIPOSizeLimit();
+    static void dumpIPOStats();
 
     void optimizeIRFunction(llvm::Module*, OptLevel, uint32_t, uint32_t, std::string);
     void customOptimizeIRFunction(llvm::Module*, std::vector<std::string>);
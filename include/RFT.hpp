@@ -5,11 +5,19 @@
 #include <manager.hpp>
 #include <timer.hpp>
 
+#include <branchRing.hpp>
+#include <branchTrace.hpp>
+#include <profileDB.hpp>
+#include <recordedAddrSet.hpp>
 #include <sparsepp/spp.h>
+#include <memory>
+#include <string>
 #include <vector>
 #include <array>
 #include <set>
 #include <fstream>
+#include <mutex>
+#include <thread>
 
 #define OIInstList std::vector<std::array<uint32_t,2>>
 
@@ -24,25 +32,44 @@ namespace dbt {
     uint8_t ExecFreq[NATIVE_REGION_SIZE];
     bool isEntry[NATIVE_REGION_SIZE];
     OIInstList OIRegion;
+    RecordedAddrSet RecordedAddrs;
 
     bool Recording = false;
     uint32_t RecordingEntry;
 
+    // 0 means no limit; oversized recordings are split in chained regions
+    unsigned RegionLimitSize = 0;
+    unsigned RegionLimitIRSize = 0;
+
     uint32_t LastTarget;
 
     Manager& TheManager;
 
+    // Detached RFTs only form regions (AsyncRFT): the jump to native code was already taken by the
+    // interpreter thread, which told where the region left to
+    bool IsDetached = false;
+    uint32_t DetachedExit;
+
+    uint32_t jumpToRegion(uint32_t);
+
     void startRegionFormation(uint32_t); 
     bool finishRegionFormation(); 
     bool isBackwardLoop(uint32_t); 
     void insertInstruction(uint32_t, uint32_t);
     void insertInstruction(std::array<uint32_t, 2>&);
+    void appendInstruction(uint32_t, uint32_t);
+    void clearRegion();
     bool hasRecordedAddrs(uint32_t);
     bool isAllowedInstToStart(unsigned, Machine&);
+    bool isOversized(const OIInstList&);
+    std::vector<OIInstList> splitRegion(const OIInstList&);
   public:
     RFT(Manager& M) : TheManager(M) {};
 
-    ~RFT() {}
+    virtual ~RFT() {}
+
+    // Builds the technique named by -rft (nullptr when the name is unknown)
+    static std::unique_ptr<RFT> create(std::string, Manager&);
 
     void printRegions();
 
@@ -51,18 +78,36 @@ namespace dbt {
     };
 
     void setRegionLimitSize(unsigned Limit) {
+      RegionLimitSize = Limit;
     };
 
+    void setRegionLimitIRSize(unsigned Limit) {
+      RegionLimitIRSize = Limit;
+    };
+
+    static unsigned estimateIRSize(uint32_t);
+
     virtual void onBranch(dbt::Machine&) = 0;
 
-    void reset() {
+    // Taken branch whose source (getLastPC) is an indirect jump or call
+    virtual void onIndirectBranch(dbt::Machine& M) { onBranch(M); }
+
+    void setDetached(bool D) { IsDetached = D; };
+
+    // Formation driven by an event that already went through native code (if Exit != target)
+    void onDetachedBranch(dbt::Machine& M, uint32_t Exit) {
+      DetachedExit = Exit;
+      onBranch(M);
+    }
+
+    virtual void reset() {
         for (unsigned I = 0; I < NATIVE_REGION_SIZE; I++) {
             ExecFreq[I] = 0;
             isEntry[I] = 0;
         }
         AlreadyCompiled.clear();
         Recording = false;
-        OIRegion.clear();
+        clearRegion();
     }
   };
 
@@ -82,6 +127,7 @@ namespace dbt {
 
     unsigned stored_index = 0;
     OIInstList stored[1000];
+    spp::sparse_hash_map<uint32_t, std::set<unsigned>> stored_entries;
 
     bool IsRelaxed;
   public:
@@ -112,6 +158,20 @@ namespace dbt {
     void onBranch(dbt::Machine&);
   };
 
+  // Compiles whole guest functions (ELF symbol boundaries) once their entry gets hot, or on the first
+  // call when eager, instead of tracing paths
+  class MethodRFT : public RFT {
+    bool IsEager;
+    unsigned Methods = 0;
+
+    void formMethodRegion(uint32_t, Machine&);
+  public:
+    MethodRFT(Manager& M, bool Eager = false) : RFT(M), IsEager(Eager) {};
+    ~MethodRFT();
+
+    void onBranch(dbt::Machine&);
+  };
+
   class NullRFT : public RFT {
   public:
     NullRFT(Manager& M) : RFT(M) {};
@@ -119,6 +179,60 @@ namespace dbt {
     void onBranch(dbt::Machine&) {};
   };
 
+  // Only records the branches to a trace (see BranchTraceWriter), no region is formed
+  class TraceRFT : public RFT {
+    BranchTraceWriter Writer;
+  public:
+    TraceRFT(Manager& M, std::string Path) : RFT(M), Writer(Path) {};
+
+    void onBranch(dbt::Machine&);
+
+    uint64_t getNumOfEvents() { return Writer.getNumOfEvents(); };
+  };
+
+  // Counts the branches taken by the interpreter in a ProfileDB before handing them to the forming RFT
+  class ProfileRFT : public RFT {
+    RFT& Inner;
+    ProfileDB& Profile;
+  public:
+    ProfileRFT(Manager& M, RFT& R, ProfileDB& P) : RFT(M), Inner(R), Profile(P) {};
+
+    void onBranch(dbt::Machine&);
+    void onIndirectBranch(dbt::Machine&);
+    void reset() { Inner.reset(); }
+  };
+
+  // The interpreter thread only takes native entries and queues its branches; a profiler thread replays
+  // them through the inner RFT on a shadow machine (same code, no state) and forms the regions
+  class AsyncRFT : public RFT {
+    typedef std::array<uint32_t, 3> BranchEvent; // Source, Target, Native exit
+
+    std::unique_ptr<RFT> Inner;
+    std::unique_ptr<BranchRing<BranchEvent, 1 << 16>> Ring;
+    std::unique_ptr<Machine> Shadow;
+
+    // Binary being emulated, published on its first branch
+    bool IsBound = false;
+    std::mutex BinaryMtx;
+    std::string BinPath;
+    uint32_t CodeStart = 0, CodeEnd = 0;
+    std::atomic<unsigned> BinaryGen{0};
+    unsigned ShadowGen = 0;
+
+    std::thread Profiler;
+    std::atomic<bool> Running{true};
+    std::atomic<bool> Busy{false};
+    uint64_t Events = 0, Stalls = 0;
+
+    void runProfiler();
+  public:
+    AsyncRFT(Manager&, std::unique_ptr<RFT>);
+    ~AsyncRFT();
+
+    void onBranch(dbt::Machine&);
+    void reset();
+  };
+
   class PreheatRFT : public RFT {
   public:
     PreheatRFT(Manager& M) : RFT(M) {};
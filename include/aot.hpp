@@ -0,0 +1,39 @@
+#ifndef AOT_HPP
+#define AOT_HPP
+
+#include <machine.hpp>
+
+#include <array>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define OIInstList std::vector<std::array<uint32_t,2>>
+
+namespace dbt {
+  // Ahead-of-time translation of a binary into a native shared object. Each region becomes an exported
+  // r<entry> function and the object carries a table of them (oi_aot_entries), which is installed in the
+  // NativeRegions at startup. Regions are bound to the .text and data layout they were compiled for, so
+  // the object records a hash of both and is refused for any other binary.
+  class AOTCompiler {
+  public:
+    struct Entry {
+      uint32_t Addrs;
+      void* Fn;
+    };
+
+    static uint64_t hashBinary(Machine&);
+
+    // Regions listed in regions.order (.oi files, as dumped by -doi)
+    static std::vector<std::pair<uint32_t, OIInstList>> readProfile(std::string);
+
+    static bool compile(Machine&, std::vector<std::pair<uint32_t, OIInstList>>&, std::string, bool Verbose = false);
+
+    // Entry -> native function (empty if the object doesn't match the binary)
+    static std::unordered_map<uint32_t, uint64_t> load(std::string, Machine&);
+  };
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef AUTOTUNER_HPP
+#define AUTOTUNER_HPP
+
+#include <sparsepp/spp.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dbt {
+  // Online search of the pass sequence of the hottest regions. Once a region was entered HotCalls times it
+  // is recompiled with every candidate sequence in turn (jobs for the compilation thread), each measured
+  // over MeasureCalls executions of the region, and the cheapest one is reinstalled. Winners are kept per
+  // binary (hash of its code, as in the profile DB), each in its own -opts file <Path>.<hash> (entry
+  // followed by the passes), merged with the winners read from it.
+  class Autotuner {
+  public:
+    struct Job {
+      uint32_t Entry;
+      unsigned Candidate;
+    };
+
+  private:
+    struct State {
+      unsigned Current = 0;
+      unsigned Skip = 0;
+      uint64_t Calls = 0, Cycles = 0;
+      std::vector<double> Costs;
+      // Candidate 0: the passes the region runs with when its tuning starts
+      std::vector<std::string> First;
+      bool Pending = false, Done = false;
+    };
+
+    std::string Path, BinaryPath;
+    unsigned MaxRegions;
+    unsigned HotCalls = 1024, MeasureCalls = 512;
+
+    // Candidate 0 is the default pipeline the regions are compiled with, unless set by setFirstPasses
+    std::vector<std::vector<std::string>> Candidates;
+
+    spp::sparse_hash_map<uint32_t, uint64_t> Calls;
+    spp::sparse_hash_map<uint32_t, std::vector<std::string>> FirstPasses;
+    std::map<uint32_t, State> Tuning;
+    std::deque<Job> Jobs;
+    std::atomic<size_t> NumOfJobs{0};
+    std::atomic<bool> Busy{false};
+    // Cleared once MaxRegions regions are tuned: region calls aren't timed any more
+    std::atomic<bool> Sampling{false};
+    std::mutex TunerMtx;
+
+    // Winners of the binary being run
+    std::unordered_map<uint32_t, std::vector<std::string>> Best;
+    uint64_t Binary = 0;
+    bool HasBinary = false;
+
+    unsigned Compiled = 0, Improved = 0, NumDone = 0;
+
+    void pushJob(uint32_t, unsigned);
+    bool write();
+
+  public:
+    Autotuner(std::string, unsigned, std::vector<std::string>);
+
+    // Cycles of one execution of the region; true when it queued a job
+    bool addSample(uint32_t, uint64_t);
+    bool isSampling() { return Sampling; }
+
+    // Measurements and jobs only hold for the binary being run, its winners are read from its own file
+    void setBinary(uint64_t);
+
+    bool hasJobs() { return NumOfJobs != 0; }
+    // A taken job keeps the tuner busy until finishJob
+    bool takeJob(Job&);
+    void finishJob() { Busy = false; }
+    bool isBusy() { return Busy; }
+    std::vector<std::string> getPasses(const Job&);
+    // The region was compiled with other passes than the default pipeline (predicted by -model)
+    void setFirstPasses(uint32_t, const std::vector<std::string>&);
+    void setInstalled(uint32_t, unsigned);
+
+    // Passes the region won with (here or in a previous run)
+    bool getBest(uint32_t, std::vector<std::string>&);
+
+    // Measurements don't survive the native regions
+    void reset();
+
+    void dumpStats();
+  };
+}
+
+#endif
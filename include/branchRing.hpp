@@ -0,0 +1,51 @@
+#ifndef BRANCHRING_HPP
+#define BRANCHRING_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace dbt {
+  // Single producer/single consumer ring. The producer (the interpreter thread) only touches the
+  // consumer's index when its cached copy says the ring is full.
+  template <typename T, size_t Size>
+  class BranchRing {
+    static_assert((Size & (Size - 1)) == 0, "BranchRing size must be a power of two");
+
+    std::array<T, Size> Slots;
+    alignas(64) std::atomic<size_t> Head{0};
+    alignas(64) std::atomic<size_t> Tail{0};
+    alignas(64) size_t CachedHead = 0;
+
+  public:
+    bool push(const T& Value) {
+      size_t CurrentTail = Tail.load(std::memory_order_relaxed);
+      if (CurrentTail - CachedHead == Size) {
+        CachedHead = Head.load(std::memory_order_acquire);
+        if (CurrentTail - CachedHead == Size)
+          return false;
+      }
+      Slots[CurrentTail & (Size - 1)] = Value;
+      Tail.store(CurrentTail + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Hands up to Max elements to Fn, in order
+    template <typename Func>
+    size_t consume(Func Fn, size_t Max = Size) {
+      size_t CurrentHead = Head.load(std::memory_order_relaxed);
+      size_t N = std::min(Tail.load(std::memory_order_acquire) - CurrentHead, Max);
+      for (size_t I = 0; I < N; I++)
+        Fn(Slots[(CurrentHead + I) & (Size - 1)]);
+      Head.store(CurrentHead + N, std::memory_order_release);
+      return N;
+    }
+
+    bool empty() {
+      return Head.load(std::memory_order_acquire) == Tail.load(std::memory_order_acquire);
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef BRANCHTRACE_HPP
+#define BRANCHTRACE_HPP
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dbt {
+  // Stream of (source, target) taken branches, as seen by RFT::onBranch. Each event is stored as two
+  // zigzag varints (source - previous target, target - source) and the stream is gzip compressed.
+  class BranchTraceWriter {
+    gzFile File;
+    std::vector<uint8_t> Buffer;
+    uint32_t LastTarget = 0;
+    uint64_t Events = 0;
+
+    void putVarint(int64_t);
+    void flush();
+
+  public:
+    BranchTraceWriter(std::string);
+    ~BranchTraceWriter();
+
+    void add(uint32_t, uint32_t);
+    uint64_t getNumOfEvents() { return Events; }
+  };
+
+  class BranchTraceReader {
+    gzFile File;
+    std::vector<uint8_t> Buffer;
+    size_t Pos = 0;
+    uint32_t LastTarget = 0;
+
+    bool getByte(uint8_t&);
+    bool getVarint(int64_t&);
+
+  public:
+    BranchTraceReader(std::string);
+    ~BranchTraceReader();
+
+    bool isOpen() { return File != nullptr; }
+    bool next(uint32_t&, uint32_t&);
+  };
+}
+
+#endif
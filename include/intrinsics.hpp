@@ -0,0 +1,22 @@
+#ifndef INTRINSICS_HPP
+#define INTRINSICS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dbt {
+  // Host implementation of a guest routine: (Registers, DataMemory, DataMemOffset). Arguments and
+  // results follow the guest calling convention (r4-r7 -> r2, f12/f14 -> f0).
+  typedef void (*IntrinsicFn)(int32_t*, uint32_t*, uint32_t);
+
+  namespace Intrinsics {
+    IntrinsicFn getHostImpl(const std::string&);
+    std::string getHostSymbol(const std::string&);
+    std::vector<std::string> getSupported();
+
+    void registerHostSymbols();
+  }
+}
+
+#endif
@@ -14,12 +14,16 @@
 #define MACHINE_HPP
 
 #include <RFT.hpp>
+#include <intrinsics.hpp>
 
 #include <cstdint>
 #include <unordered_map>
 #include <memory>
 #include <vector>
 #include <functional>
+#include <map>
+#include <set>
+#include <string>
 
 //#define DUMP_REGISTER_JUMP
 //#define PRINTINST
@@ -29,7 +33,6 @@
 #define uptr std::unique_ptr
 
 #define STACK_SIZE 128 * 1024 * 1024 /*8mb*/
-#define HEAP_SIZE  128 * 1024 * 1024 /*8mb*/
 
 namespace dbt {
   union Word {
@@ -47,10 +50,16 @@ namespace dbt {
 
   class RFT;
 
+  // The data window is reserved with mmap(MAP_NORESERVE), so pages are only committed when the guest touches them
+  struct GuestMemoryDeleter {
+    size_t Size = 0;
+    void operator()(char*) const;
+  };
+
   class Machine {
   private:
     uint32_t stackSize = STACK_SIZE;
-    uint32_t heapSize = HEAP_SIZE;
+    uint32_t heapSize = 0;
     bool preheating = false;
 
     // Int Regs     0   -  63
@@ -62,7 +71,7 @@ namespace dbt {
     // Temp: 8-15, 24-25
     int32_t Register[258] __attribute__ ((aligned (16)));
 
-    uptr<char[]> DataMemory;
+    std::unique_ptr<char[], GuestMemoryDeleter> DataMemory;
     uptr<Word[]> CodeMemory;
 
     uint32_t DataMemOffset;
@@ -72,6 +81,14 @@ namespace dbt {
     uint32_t DataMemLimit;
     uint32_t CodeMemLimit;
 
+    // Heap area (between the data sections and the stack): brk grows up from HeapBase, anonymous
+    // mmaps are carved down from HeapLimit and freed ranges are kept for reuse
+    uint32_t HeapBase, HeapBreak, MapBottom, HeapLimit;
+    std::map<uint32_t, uint32_t> FreeMappings;
+    uint32_t MappedBytes = 0, PeakBreakUse = 0, PeakMappedBytes = 0;
+
+    void releaseMemory(uint32_t, uint32_t);
+
     uint32_t LastPC;
     uint32_t PC;
 
@@ -81,6 +98,10 @@ namespace dbt {
     std::string BinPath;
 
     std::unordered_map<uint32_t, std::pair<std::string, uint32_t>> Symbolls;
+
+    std::set<std::string> EnabledIntrinsics;
+    std::unordered_map<uint32_t, std::pair<std::string, IntrinsicFn>> IntrinsicEntries;
+    void bindIntrinsics();
   public:
     Machine() { Register[0] = 0; };
 
@@ -103,6 +124,13 @@ namespace dbt {
     void setStackSize(uint32_t size) { stackSize = size; };
     void setHeapSize(uint32_t size)  { heapSize = size;  };
 
+    uint32_t setBreak(uint32_t);
+    uint32_t mapAnonymous(uint32_t);
+    void unmapAnonymous(uint32_t, uint32_t);
+
+    uint32_t getPeakBreakUse()    { return PeakBreakUse; };
+    uint32_t getPeakMappedBytes() { return PeakMappedBytes; };
+
     Word getInstAt(uint32_t);
     Word getInstAtPC();
     Word getNextInst();
@@ -141,7 +169,19 @@ namespace dbt {
     uint32_t findMethod(uint32_t);
     std::vector<uint32_t> getVectorOfMethodEntries();
 
-    int loadELF(const std::string);
+    void setEnabledIntrinsics(std::set<std::string> Names) { EnabledIntrinsics = Names; };
+
+    IntrinsicFn getIntrinsic(uint32_t Addr) {
+      if (IntrinsicEntries.empty()) return nullptr;
+      auto It = IntrinsicEntries.find(Addr);
+      return It == IntrinsicEntries.end() ? nullptr : It->second.second;
+    }
+
+    std::string getIntrinsicName(uint32_t Addr) {
+      return IntrinsicEntries[Addr].first;
+    }
+
+    int loadELF(const std::string, bool CodeOnly = false);
 
     std::string getBinPath() { return BinPath; };
 
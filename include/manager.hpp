@@ -8,7 +8,12 @@
 #include <IREmitter.hpp>
 #include <IROpt.hpp>
 #include <IRJIT.hpp>
+#include <autotuner.hpp>
 #include <machine.hpp>
+#include <pipelineModel.hpp>
+#include <profileDB.hpp>
+#include <regionArchive.hpp>
+#include <regionCache.hpp>
 #include <thread>
 #include <mutex>
 #include <shared_mutex>
@@ -18,6 +23,8 @@
 #include <stack>
 #include <unistd.h>
 #include <chrono>
+#include <deque>
+#include <map>
 
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
@@ -40,6 +47,30 @@ namespace dbt {
       std::mutex NR;
       std::condition_variable cv;
       std::atomic<size_t> NumOfOIRegions; 
+
+      // Statically picked regions (StaticCFG), only compiled while no formed region is waiting
+      std::deque<std::pair<uint32_t, OIInstList>> SpeculativeRegions;
+      std::mutex SpeculativeMtx;
+      std::atomic<size_t> NumOfSpeculative{0};
+      std::atomic<bool> SpeculativeBusy{false};
+      unsigned SpeculativeQueued = 0, SpeculativeCompiled = 0;
+
+      // Whole compilation (-wc) split in one module per method with loaded entries, compiled by NumOfThreads workers
+      unsigned NumOfThreads = 1;
+      std::vector<std::pair<std::vector<uint32_t>, OIInstList>> WholePartitions;
+      uint64_t* PlannedRegions = nullptr;
+
+      // Loaded regions (-lr/-loi) compiled by the workers in loading order; the emulation waits for the
+      // first PreloadCount of them
+      bool IsToPreload = false;
+      unsigned PreloadCount = 0;
+      std::vector<uint32_t> PreloadEntries;
+      bool IsPreloaded = false;
+      std::mutex PreloadMtx;
+      std::condition_variable PreloadCV;
+
+      // Native regions loaded ahead of time (AOTCompiler::load), reinstalled on every reset
+      std::unordered_map<uint32_t, uint64_t> PreinstalledRegions;
       std::unordered_map<uint32_t, OIInstList> CompiledOIRegions;
       std::vector<uint32_t> IRRegionsKey;
       std::set<uint32_t> TouchedEntries;
@@ -62,6 +93,17 @@ namespace dbt {
       std::unique_ptr<IREmitter> IRE;
       std::unique_ptr<IROpt> IRO;
       std::unique_ptr<llvm::orc::IRJIT> IRJIT;
+      std::unique_ptr<RegionCache> RCache;
+
+      // Formed regions are recorded here to warm start the next runs
+      ProfileDB* Profile = nullptr;
+
+      // Recompiles the hottest regions with other pass sequences when there is nothing else to compile
+      std::unique_ptr<Autotuner> Tuner;
+
+      // Predicts the passes of the regions without a pass list of their own
+      std::unique_ptr<PipelineModel> Model;
+      std::atomic<unsigned> PredictedRegions{0};
 
       std::atomic<bool> isRegionRecorging;
       std::atomic<bool> isRunning;
@@ -81,14 +123,37 @@ namespace dbt {
       bool IsToDoWholeCompilation = false;
       bool IsToLoadBCFormat = true;
       bool IsToInline = false;
+      bool IsToEmitLoopIdioms = false;
+      bool IsToVectorize = false;
+      bool IsToPartitionMemory = false;
+      bool IsToEmitInRegionSyscalls = false;
+      bool IsSimulation = false;
+      unsigned VectorizedLoops = 0;
+
+      // Region size bucket (OI instructions, power of two) -> (regions, total compile time in ms)
+      std::map<unsigned, std::pair<unsigned, double>> CompileTimeBySize;
 
       llvm::Module* loadRegionFromFile(std::string);
       void loadRegionsFromFiles();
 
+      // Dumps and loads go through a single RegionArchive instead of r<N>.oi/.bc files when set
+      std::string ArchivePath;
+      std::unique_ptr<RegionArchive> Archive;
+      std::unordered_map<uint32_t, std::vector<std::string>> ArchivedOpts;
+      llvm::Module* loadRegionFromArchive(uint32_t);
+      void dumpRegionArchive(bool, bool);
+
       std::ofstream* PerfMapFile; 
 
       void inlineCall(uint32_t, uint32_t, OIInstList&, std::set<uint32_t>&, llvm::Module*);
 
+      bool takeSpeculativeRegion(uint32_t&, OIInstList&);
+      void compileTuningCandidate(Autotuner::Job);
+      void optimizeRegion(IROpt&, llvm::Module*, uint32_t, const std::vector<uint32_t>&, const OIInstList&);
+      void partitionWholeRegion(const OIInstList&, const std::vector<uint32_t>&);
+      OIInstList readOIRegion(uint32_t);
+      void compileInParallel(const std::vector<std::pair<std::vector<uint32_t>, OIInstList>>&, bool);
+      void preloadInParallel();
       void runPipeline();
 
     public:
@@ -112,6 +177,33 @@ namespace dbt {
         std::cerr << "Compiled OI: " << OICompiled << "\n";
         std::cerr << "Compiled LLVM: " << LLVMCompiled << std::endl;
         std::cerr << "LLVM/OI: " << ((float)(LLVMCompiled+1)/(OICompiled+1)) << std::endl;
+        if (IsToVectorize)
+          std::cerr << "Vectorized Loops: " << VectorizedLoops << std::endl;
+        if (!CompileTimeBySize.empty()) {
+          std::cerr << "Compile time by region size (OI insts <= : regions, avg ms):\n";
+          for (auto& Point : CompileTimeBySize)
+            std::cerr << "  " << Point.first << ": " << Point.second.first << ", "
+              << Point.second.second / Point.second.first << "\n";
+        }
+        if (!PreinstalledRegions.empty())
+          std::cerr << "Preinstalled (AOT) Regions: " << PreinstalledRegions.size() << "\n";
+        if (SpeculativeQueued != 0)
+          std::cerr << "Speculative Regions: " << SpeculativeCompiled << " compiled of " << SpeculativeQueued << " queued\n";
+        if (RCache) {
+          std::cerr << "Region Cache Hits: " << RCache->getHits() << " (" << RCache->getRelocated() << " relocated, "
+            << RCache->getDiskHits() << " from disk)\n";
+          std::cerr << "Region Cache Misses: " << RCache->getMisses() << std::endl;
+        }
+
+        if (Tuner)
+          Tuner->dumpStats();
+
+        if (Model)
+          std::cerr << "Pipeline Model: " << PredictedRegions << " regions predicted\n";
+
+        if (IROpt::isTimingPasses())
+          IROpt::dumpPassStats();
+        IROpt::dumpIPOStats();
       }
 
       ~Manager() {
@@ -125,12 +217,83 @@ namespace dbt {
           for (unsigned i = 0; i < ThreadPool.size(); i++) 
             	ThreadPool[i].detach();
         }
+
+        free(PlannedRegions);
       }
 
       void setDataMemOffset(uint32_t DMO) {
         DataMemOffset = DMO;
       }
 
+      // Regions are installed as soon as they are formed and never compiled nor executed: used to replay
+      // branch traces through the RFTs (oi-rftsim)
+      void setSimulation(bool S) {
+        IsSimulation = S;
+      }
+
+      void setNumOfThreads(unsigned N) {
+        NumOfThreads = N < 1 ? 1 : N;
+      }
+
+      void setPreload(bool P, unsigned Count) {
+        IsToPreload = P;
+        PreloadCount = Count;
+      }
+
+      void waitForPreload() {
+        if (!IsToPreload)
+          return;
+        std::unique_lock<std::mutex> Lock(PreloadMtx);
+        PreloadCV.wait(Lock, [this] { return IsPreloaded || PreloadEntries.empty(); });
+      }
+
+      void setInRegionSyscalls(bool S) {
+        IsToEmitInRegionSyscalls = S;
+      }
+
+      void setMemoryPartitions(bool P) {
+        IsToPartitionMemory = P;
+      }
+
+      void setVectorize(bool V) {
+        IsToVectorize = V;
+      }
+
+      void setLoopIdioms(bool E) {
+        IsToEmitLoopIdioms = E;
+      }
+
+      void setRegionArchive(std::string Path) {
+        ArchivePath = Path;
+      }
+
+      void setRegionCache(std::string Path) {
+        RCache = std::make_unique<RegionCache>(Path);
+      }
+
+      void setProfile(ProfileDB* P) {
+        Profile = P;
+      }
+
+      bool setPipelineModel(std::string Path) {
+        Model = std::make_unique<PipelineModel>();
+        if (Model->load(Path) && Model->getNumOfSamples() != 0)
+          return true;
+        Model.reset();
+        return false;
+      }
+
+      // Called after setVectorize: the default pipeline is the first candidate
+      void setAutotuner(std::string Path, unsigned MaxRegions) {
+        Tuner = std::make_unique<Autotuner>(Path, MaxRegions,
+            IROpt::getPassList(IsToVectorize ? IROpt::OptLevel::Vector : IROpt::OptLevel::Basic));
+      }
+
+      void setTunedBinary(uint64_t Hash) {
+        if (Tuner)
+          Tuner->setBinary(Hash);
+      }
+
       void setOptPolicy(OptPolitic OM) {
         OptMode = OM;
       }
@@ -179,6 +342,8 @@ namespace dbt {
       }
 
       bool addOIRegion(uint32_t, OIInstList);
+      void setPreinstalledRegions(std::unordered_map<uint32_t, uint64_t>);
+      void addSpeculativeRegions(std::vector<std::pair<uint32_t, OIInstList>>);
 
       int32_t jumpToRegion(uint32_t);
 
@@ -235,6 +400,10 @@ namespace dbt {
 
       void dumpRegions(bool MergeRegions = false, bool OnlyOI = false) {
         while (getNumOfOIRegions() != 0) {}
+        if (!ArchivePath.empty()) {
+          dumpRegionArchive(MergeRegions, OnlyOI);
+          return;
+        }
         if (!OnlyOI) {
           std::cerr << "Dumping IR regions!\n";
           for (auto& M : IRRegions) {
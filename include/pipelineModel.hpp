@@ -0,0 +1,48 @@
+#ifndef PIPELINEMODEL_HPP
+#define PIPELINEMODEL_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define OIInstList std::vector<std::array<uint32_t,2>>
+
+namespace dbt {
+  // Picks the pass list of a region from its static features (size, instruction mix, loops) with a
+  // nearest centroid classifier. The samples are regions together with the pass list that won for them
+  // in -opts experiments (or -tune); each distinct pass list is a class.
+  class PipelineModel {
+  public:
+    enum Feature { Size, Loads, Stores, Branches, Calls, Indirects, Floats, MulDivs, Loops, NumOfFeatures };
+    typedef std::array<double, NumOfFeatures> Features;
+
+  private:
+    std::vector<std::vector<std::string>> Pipelines;
+    std::vector<std::pair<unsigned, Features>> Samples;
+
+    std::vector<Features> Centroids;
+    std::vector<unsigned> Counts;
+    Features Scale;
+
+    void fit();
+
+  public:
+    static Features getFeatures(const OIInstList&);
+
+    // Loading fits the model; added samples are only written
+    bool load(std::string);
+    bool write(std::string);
+
+    void addSample(const OIInstList&, const std::vector<std::string>&);
+
+    // nullptr when there is nothing to predict from
+    const std::vector<std::string>* predict(const OIInstList&) const;
+
+    size_t getNumOfSamples() const { return Samples.size(); }
+    size_t getNumOfPipelines() const { return Pipelines.size(); }
+  };
+}
+
+#endif
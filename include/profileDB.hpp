@@ -0,0 +1,61 @@
+#ifndef PROFILEDB_HPP
+#define PROFILEDB_HPP
+
+#include <sparsepp/spp.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define OIInstList std::vector<std::array<uint32_t,2>>
+
+namespace dbt {
+  class Machine;
+
+  // Guest level profile of a binary (branch target and indirect target counts, formed regions) kept in
+  // <dir>/<binary hash>.prof and merged with the profile of every run. It only holds guest addresses and
+  // words, so it stays valid across DBT and LLVM versions, unlike dumped bitcode.
+  class ProfileDB {
+    std::string Path;
+    uint64_t BinaryHash;
+    unsigned Runs = 0;
+
+    spp::sparse_hash_map<uint32_t, uint64_t> BranchFreq;
+    spp::sparse_hash_map<uint32_t, std::map<uint32_t, uint64_t>> IndirectTargets;
+    std::map<uint32_t, OIInstList> Regions;
+    std::mutex RegionsMtx;
+
+    bool load();
+
+  public:
+    ProfileDB(std::string Dir, Machine&);
+
+    void addBranch(uint32_t Target) {
+      BranchFreq[Target] += 1;
+    }
+
+    void addIndirectBranch(uint32_t Source, uint32_t Target) {
+      BranchFreq[Target] += 1;
+      IndirectTargets[Source][Target] += 1;
+    }
+
+    void addRegion(uint32_t, const OIInstList&);
+
+    // Recorded regions, the most often entered first
+    std::vector<std::pair<uint32_t, OIInstList>> getHotRegions();
+
+    // Target -> count of the indirect branch at the address (empty if never seen)
+    std::map<uint32_t, uint64_t> getIndirectTargets(uint32_t);
+
+    unsigned getNumOfRuns() { return Runs; }
+    size_t getNumOfRegions() { return Regions.size(); }
+
+    bool write();
+  };
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef RECORDEDADDRSET_HPP
+#define RECORDEDADDRSET_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace dbt {
+  // Open addressing set of the addresses in the region being recorded. It grows with the largest
+  // recording seen and clear() only touches the slots that were used.
+  class RecordedAddrSet {
+    static constexpr uint32_t Empty = 0xFFFFFFFF; // Instruction addresses are word aligned
+
+    std::vector<uint32_t> Table;
+    std::vector<uint32_t> Used; // Slots
+    uint32_t Mask;
+
+    uint32_t find(uint32_t Addrs) const {
+      uint32_t Slot = ((Addrs >> 2) * 0x9E3779B1) & Mask;
+      while (Table[Slot] != Empty && Table[Slot] != Addrs)
+        Slot = (Slot + 1) & Mask;
+      return Slot;
+    }
+
+    void grow() {
+      std::vector<uint32_t> Addrs;
+      for (auto Slot : Used)
+        Addrs.push_back(Table[Slot]);
+
+      Used.clear();
+      Table.assign(Table.size() * 2, Empty);
+      Mask = Table.size() - 1;
+      for (auto A : Addrs)
+        insert(A);
+    }
+
+  public:
+    RecordedAddrSet(uint32_t InitialSize = 256) : Table(InitialSize, Empty), Mask(InitialSize - 1) {}
+
+    bool count(uint32_t Addrs) const {
+      return Table[find(Addrs)] == Addrs;
+    }
+
+    void insert(uint32_t Addrs) {
+      if ((Used.size() + 1) * 2 > Table.size())
+        grow();
+
+      uint32_t Slot = find(Addrs);
+      if (Table[Slot] == Empty) {
+        Table[Slot] = Addrs;
+        Used.push_back(Slot);
+      }
+    }
+
+    void clear() {
+      for (auto Slot : Used)
+        Table[Slot] = Empty;
+      Used.clear();
+    }
+  };
+}
+
+#endif
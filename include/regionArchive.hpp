@@ -0,0 +1,65 @@
+#ifndef REGIONARCHIVE_HPP
+#define REGIONARCHIVE_HPP
+
+#include "llvm/ADT/StringRef.h"
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define OIInstList std::vector<std::array<uint32_t,2>>
+
+namespace dbt {
+  // Single file replacing the r<N>.oi/r<N>.bc/regions.order dumps. A fixed size index (one record per region,
+  // in formation order) is followed by the OI instruction arrays, the bitcode blobs and the optimization
+  // lists. The reader maps the file and only touches a region's data when it is asked for.
+  struct RegionArchiveRecord {
+    uint32_t Entry;
+    uint32_t NumInsts;
+    uint64_t InstsOffset;
+    uint64_t BitcodeOffset;
+    uint64_t BitcodeSize;
+    uint64_t OptsOffset;
+    uint32_t OptsSize;
+    uint32_t Hotness;     // Rank in which the region became hot (0 is the first)
+  };
+
+  class RegionArchiveWriter {
+    struct Region {
+      uint32_t Entry;
+      OIInstList Insts;
+      std::string Bitcode;
+      std::string Opts;
+    };
+    std::vector<Region> Regions;
+
+  public:
+    void add(uint32_t, const OIInstList&, std::string Bitcode = "", std::vector<std::string> Opts = {});
+    bool write(std::string);
+  };
+
+  class RegionArchive {
+    const char* Data = nullptr;
+    size_t Size = 0;
+    const RegionArchiveRecord* Records = nullptr;
+    uint32_t NumRecords = 0;
+    std::unordered_map<uint32_t, uint32_t> Index;
+
+  public:
+    RegionArchive(std::string);
+    ~RegionArchive();
+
+    bool isValid() { return Records != nullptr; }
+
+    // Entries in formation (hotness) order
+    std::vector<uint32_t> getEntries();
+
+    bool hasRegion(uint32_t Entry) { return Index.count(Entry) != 0; }
+    OIInstList getRegion(uint32_t);
+    llvm::StringRef getBitcode(uint32_t);
+    std::vector<std::string> getOpts(uint32_t);
+  };
+}
+
+#endif
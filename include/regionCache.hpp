@@ -0,0 +1,52 @@
+#ifndef REGIONCACHE_HPP
+#define REGIONCACHE_HPP
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define OIInstList std::vector<std::array<uint32_t,2>>
+
+namespace dbt {
+  class Machine;
+
+  // Optimized regions indexed by a hash of their OI instructions and relative layout. Regions emitted
+  // relocatable (IREmitter::setRelocatable) can be reinstalled at any entry with the same content,
+  // which lets binaries sharing (libc) code reuse each other's compiled regions.
+  class RegionCache {
+    std::string CachePath;
+    std::unordered_map<uint64_t, std::string> Regions;
+    std::mutex CacheMtx;
+
+    unsigned Hits = 0, Misses = 0, Relocated = 0, DiskHits = 0;
+
+    std::string getRegionPath(uint64_t);
+    bool loadFromDisk(uint64_t);
+
+  public:
+    RegionCache(std::string Path = "");
+
+    static uint64_t hashBytes(const void*, size_t, uint64_t Seed = 0xcbf29ce484222325ULL);
+
+    // Seed of hashRegion: the emitter and optimizer settings that change the code of a region
+    static uint64_t hashConfig(const std::vector<uint32_t>&);
+    static uint64_t hashRegion(uint32_t, const OIInstList&, uint32_t, dbt::Machine&, uint64_t);
+
+    static void bindRelocations(llvm::Module&, int32_t);
+
+    llvm::Module* lookup(uint64_t, uint32_t, llvm::LLVMContext&);
+    void insert(uint64_t, uint32_t, llvm::Module&);
+
+    unsigned getHits()      { return Hits; }
+    unsigned getMisses()    { return Misses; }
+    unsigned getRelocated() { return Relocated; }
+    unsigned getDiskHits()  { return DiskHits; }
+  };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef STATICCFG_HPP
+#define STATICCFG_HPP
+
+#include <machine.hpp>
+
+#include <array>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define OIInstList std::vector<std::array<uint32_t,2>>
+
+namespace dbt {
+  // Control flow of the loaded .text recovered from the direct branches (getPossibleTargets). Loops are
+  // the backward branches inside a method; their nesting depth and the calls made from inside them are
+  // used as a static guess of where the hot code is.
+  class StaticCFG {
+    struct Loop {
+      uint32_t Header, Latch;
+      unsigned Depth;
+    };
+
+    Machine& TheMachine;
+    std::vector<uint32_t> MethodEntries;
+    std::vector<Loop> Loops;
+    std::unordered_map<uint32_t, unsigned> CalledFromLoops; // Method entry -> deepest loop calling it
+    std::unordered_map<uint32_t, std::set<uint32_t>> Callees; // Method entry -> methods it calls or jumps to
+
+    uint32_t getMethodEnd(uint32_t);
+    bool isAllowedToStart(uint32_t);
+    OIInstList getRegion(uint32_t, uint32_t);
+
+  public:
+    StaticCFG(Machine&);
+
+    unsigned getNumOfLoops() { return Loops.size(); }
+
+    // Entry of the method containing the address (0 if none)
+    uint32_t getMethod(uint32_t);
+
+    // Up to Max (entry, region) pairs, hottest looking first: outermost loops under MaxSize instructions
+    // and the methods called from loops
+    std::vector<std::pair<uint32_t, OIInstList>> getSpeculativeRegions(unsigned Max, unsigned MaxSize);
+
+    // Whole methods reachable by direct calls and jumps from the given ones
+    std::vector<std::pair<uint32_t, OIInstList>> getReachableMethods(std::set<uint32_t>);
+  };
+}
+
+#endif
@@ -3,21 +3,80 @@
 
 #include <machine.hpp>
 
+#include <unordered_map>
+#include <vector>
+
 namespace dbt {
   class SyscallManager {
   protected:
     uint8_t ExitStatus;
   public:
+    virtual ~SyscallManager() {};
+
     uint8_t getExitStatus() { return ExitStatus; };
 
     virtual int processSyscall(Machine&) = 0;
+
+    // Whether the syscall can be served from inside a native region (it must not stop the emulation)
+    virtual bool canRunInRegion(Machine&) { return false; };
+
+    // Makes this manager the one called by dbt_region_syscall from compiled regions
+    void setAsRegionSyscallHandler(Machine&);
   };
 
   class LinuxSyscallManager : public SyscallManager {
+    private:
+      // Write combining: guest writes to stdout/stderr and to files it opened for writing are kept in
+      // per fd buffers until a point where the order or the file content becomes observable
+      size_t WriteBufferSize = 0;
+      std::unordered_map<int, std::vector<char>> WriteBuffers;
+      uint32_t BufferedWrites = 0, FlushWrites = 0;
+
+      bool isBuffered(int FD) { return WriteBufferSize != 0 && WriteBuffers.count(FD) != 0; };
+      void flushWriteBuffer(int);
+      ssize_t bufferedWrite(int, const char*, size_t);
+
+      // Reads from ttys/pipes may block on the user, who has to see every pending prompt first
+      std::unordered_map<int, bool> BlockingFDs;
+      bool mayBlock(int);
+      void flushTtyBuffers();
+
+      // Files the guest opens read only can be mapped, reads are then served from the mapping (the size is
+      // the one at open). Stable files can also have their pages remapped into the guest.
+      struct MappedFile {
+        char* Data;
+        size_t Size;
+        size_t Offset;
+        bool Stable;
+      };
+
+      bool IsToMapInputFiles = false;
+      std::unordered_map<int, MappedFile> MappedFiles;
+      uint64_t MappedBytes = 0, RemappedBytes = 0;
+
+      void mapInputFile(int);
+      void unmapInputFile(int);
+      ssize_t mappedRead(int, char*, size_t);
+      off_t mappedSeek(int, off_t, int);
+
     public:
-      enum SyscallType { Exit = 1, Read=0x3, Write = 0x4, Open=0x5, Close=0x6, Creat=0x8, Lseek=0x13, Stat=106, Fstat = 108 };
+      enum SyscallType { Exit = 1, Read=0x3, Write = 0x4, Open=0x5, Close=0x6, Creat=0x8, Lseek=0x13, Brk=45, Mmap=90, Munmap=91,
+        Stat=106, Fstat = 108, Mmap2=210 };
+
+      ~LinuxSyscallManager();
+
       int processSyscall(Machine&);
+      bool canRunInRegion(Machine&);
+
+      void setWriteBufferSize(size_t);
+      void setMapInputFiles(bool E) { IsToMapInputFiles = E; };
+      void flushWriteBuffers();
+
+      uint32_t getSavedWriteSyscalls() { return BufferedWrites > FlushWrites ? BufferedWrites - FlushWrites : 0; };
   };
 }
 
+// Entry point called by regions: returns 0 when the syscall was served and the region can go on
+extern "C" int32_t dbt_region_syscall(int32_t*, uint32_t*);
+
 #endif
@@ -0,0 +1,51 @@
+#ifndef SYSCALLLOG_HPP
+#define SYSCALLLOG_HPP
+
+#include <syscall.hpp>
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+namespace dbt {
+  // Log entry: syscall number, arguments (r5-r7), result (r2), whether the emulation stopped, and the guest
+  // memory ranges the syscall wrote
+  struct SyscallLogEntry {
+    uint32_t Number;
+    std::array<int32_t, 3> Args;
+    int32_t Result;
+    uint8_t Stop;
+    std::vector<std::pair<uint32_t, std::string>> Written;
+  };
+
+  // Runs the syscalls on Inner and appends each one to a binary log
+  class RecordingSyscallManager : public SyscallManager {
+    std::unique_ptr<SyscallManager> Inner;
+    std::ofstream Log;
+
+  public:
+    RecordingSyscallManager(std::string, std::unique_ptr<SyscallManager>);
+    ~RecordingSyscallManager();
+
+    int processSyscall(Machine&);
+    bool canRunInRegion(Machine& M) { return Inner->canRunInRegion(M); };
+  };
+
+  // Serves the syscalls from a log recorded by RecordingSyscallManager without touching the host files. Only
+  // the guest memory management (brk/mmap) and writes to stdout/stderr still go to Inner.
+  class ReplaySyscallManager : public SyscallManager {
+    std::unique_ptr<SyscallManager> Inner;
+    std::ifstream Log;
+    uint32_t Replayed = 0;
+
+    bool readEntry(SyscallLogEntry&);
+
+  public:
+    ReplaySyscallManager(std::string, std::unique_ptr<SyscallManager>);
+
+    int processSyscall(Machine&);
+    bool canRunInRegion(Machine& M) { return Inner->canRunInRegion(M); };
+  };
+}
+
+#endif
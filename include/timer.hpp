@@ -54,6 +54,11 @@ namespace dbt {
           acc[i] += values[i];*/
       }
 
+      double getTime() {
+        uint64_t delta_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+        return delta_us/1000000.0;
+      }
+
       void printReport(std::string Title) {
         uint64_t delta_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
   
@@ -55,6 +55,15 @@ uint64_t instacc = 0;
     }\
     GOTO_NEXT
 
+#define IMPLEMENT_IJMP(Label, Code)\
+  Label:\
+    I = getDecodedInst(M.getPC());\
+    {\
+      Code\
+      ImplRFT.onIndirectBranch(M);\
+    }\
+    GOTO_NEXT
+
 #define IMPLEMENT_BR(Label, Code)\
   Label:\
     /*M.dumpRegisters();*/\
@@ -847,15 +856,27 @@ void ITDInterpreter::dispatch(Machine& M, uint32_t StartAddrs, uint32_t EndAddrs
 
   IMPLEMENT_JMP(call,
       M.setRegister(31, M.getPC()+4);
-      M.setPC((M.getPC() & 0xF0000000) | (I.Addrs << 2));
+      uint32_t Target = (M.getPC() & 0xF0000000) | (I.Addrs << 2);
+      if (IntrinsicFn Intrinsic = M.getIntrinsic(Target)) {
+        Intrinsic(M.getRegisterPtr(), M.getMemoryPtr(), M.getDataMemOffset());
+        M.setPC(M.getPC()+4);
+      } else {
+        M.setPC(Target);
+      }
     );
 
-  IMPLEMENT_JMP(callr,
+  IMPLEMENT_IJMP(callr,
       M.setRegister(31, M.getPC()+4);
-      M.setPC(M.getRegister(I.RT));
+      uint32_t Target = M.getRegister(I.RT);
+      if (IntrinsicFn Intrinsic = M.getIntrinsic(Target)) {
+        Intrinsic(M.getRegisterPtr(), M.getMemoryPtr(), M.getDataMemOffset());
+        M.setPC(M.getPC()+4);
+      } else {
+        M.setPC(Target);
+      }
     );
 
-  IMPLEMENT_JMP(jumpr,
+  IMPLEMENT_IJMP(jumpr,
       M.setPC(M.getRegister(I.RT));
     );
 
@@ -863,7 +884,7 @@ void ITDInterpreter::dispatch(Machine& M, uint32_t StartAddrs, uint32_t EndAddrs
       M.setPC((M.getPC() & 0xF0000000) | (I.Addrs << 2));
     );
 
-  IMPLEMENT_JMP(ijmp,
+  IMPLEMENT_IJMP(ijmp,
       M.setRegister(IJMP_REG, M.getRegister(IJMP_REG) & 0xFFFFF000);
       M.setRegister(IJMP_REG, M.getRegister(IJMP_REG) | (I.Imm & 0xFFF));
       uint32_t Target = M.getMemValueAt(M.getRegister(IJMP_REG) + M.getRegister(I.RT)).asI_;
@@ -0,0 +1,129 @@
+#include <intrinsics.hpp>
+
+#include "llvm/Support/DynamicLibrary.h"
+
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+using namespace dbt;
+
+static inline char* guestPtr(uint32_t* Mem, uint32_t Offset, int32_t Addrs) {
+  return reinterpret_cast<char*>(Mem) + (static_cast<uint32_t>(Addrs) - Offset);
+}
+
+static inline double& doubleReg(int32_t* Regs, uint16_t R) {
+  return reinterpret_cast<double*>(Regs)[R + 65];
+}
+
+static inline float& floatReg(int32_t* Regs, uint16_t R) {
+  return reinterpret_cast<float*>(Regs)[R + 66];
+}
+
+// The host libc versions are vectorized (and selected for the running CPU), so we just forward to them
+extern "C" {
+  void dbt_intrinsic_memcpy(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    std::memcpy(guestPtr(Mem, Offset, Regs[4]), guestPtr(Mem, Offset, Regs[5]), static_cast<uint32_t>(Regs[6]));
+    Regs[2] = Regs[4];
+  }
+
+  void dbt_intrinsic_memmove(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    std::memmove(guestPtr(Mem, Offset, Regs[4]), guestPtr(Mem, Offset, Regs[5]), static_cast<uint32_t>(Regs[6]));
+    Regs[2] = Regs[4];
+  }
+
+  void dbt_intrinsic_memset(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    std::memset(guestPtr(Mem, Offset, Regs[4]), Regs[5], static_cast<uint32_t>(Regs[6]));
+    Regs[2] = Regs[4];
+  }
+
+  void dbt_intrinsic_strlen(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    Regs[2] = std::strlen(guestPtr(Mem, Offset, Regs[4]));
+  }
+
+  void dbt_intrinsic_strcmp(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    Regs[2] = std::strcmp(guestPtr(Mem, Offset, Regs[4]), guestPtr(Mem, Offset, Regs[5]));
+  }
+
+  void dbt_intrinsic_sqrt(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::sqrt(doubleReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_sqrtf(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    floatReg(Regs, 0) = std::sqrt(floatReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_sin(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::sin(doubleReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_cos(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::cos(doubleReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_exp(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::exp(doubleReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_log(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::log(doubleReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_pow(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::pow(doubleReg(Regs, 12), doubleReg(Regs, 14));
+  }
+
+  void dbt_intrinsic_floor(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::floor(doubleReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_ceil(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::ceil(doubleReg(Regs, 12));
+  }
+
+  void dbt_intrinsic_fabs(int32_t* Regs, uint32_t* Mem, uint32_t Offset) {
+    doubleReg(Regs, 0) = std::fabs(doubleReg(Regs, 12));
+  }
+}
+
+static const std::unordered_map<std::string, IntrinsicFn> HostImpls = {
+  {"memcpy",  dbt_intrinsic_memcpy},
+  {"memmove", dbt_intrinsic_memmove},
+  {"memset",  dbt_intrinsic_memset},
+  {"strlen",  dbt_intrinsic_strlen},
+  {"strcmp",  dbt_intrinsic_strcmp},
+  {"sqrt",    dbt_intrinsic_sqrt},
+  {"sqrtf",   dbt_intrinsic_sqrtf},
+  {"sin",     dbt_intrinsic_sin},
+  {"cos",     dbt_intrinsic_cos},
+  {"exp",     dbt_intrinsic_exp},
+  {"log",     dbt_intrinsic_log},
+  {"pow",     dbt_intrinsic_pow},
+  {"floor",   dbt_intrinsic_floor},
+  {"ceil",    dbt_intrinsic_ceil},
+  {"fabs",    dbt_intrinsic_fabs},
+};
+
+IntrinsicFn Intrinsics::getHostImpl(const std::string& Name) {
+  auto It = HostImpls.find(Name);
+  if (It == HostImpls.end())
+    return nullptr;
+  return It->second;
+}
+
+std::string Intrinsics::getHostSymbol(const std::string& Name) {
+  return "dbt_intrinsic_" + Name;
+}
+
+std::vector<std::string> Intrinsics::getSupported() {
+  std::vector<std::string> Names;
+  for (auto& KV : HostImpls)
+    Names.push_back(KV.first);
+  return Names;
+}
+
+// Makes the implementations visible to the JIT symbol resolver
+void Intrinsics::registerHostSymbols() {
+  for (auto& KV : HostImpls)
+    llvm::sys::DynamicLibrary::AddSymbol(getHostSymbol(KV.first), reinterpret_cast<void*>(KV.second));
+}
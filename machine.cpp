@@ -1,7 +1,10 @@
 #include <elfio/elfio.hpp>
 #include <machine.hpp>
 
+#include <algorithm>
 #include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
 
 using namespace dbt;
 
@@ -35,11 +38,128 @@ void Machine::setCodeMemory(uint32_t StartAddress, uint32_t Size, const char* Co
   }
 }
 
+#define GUEST_PAGE_SIZE 4096
+#define GUEST_MEMORY_TOP 0xFFFFF000
+
+static uint32_t alignToPage(uint32_t Addrs) {
+  return (Addrs + GUEST_PAGE_SIZE - 1) & ~(GUEST_PAGE_SIZE - 1);
+}
+
+void GuestMemoryDeleter::operator()(char* Memory) const {
+  munmap(Memory, Size);
+}
+
 void Machine::allocDataMemory(uint32_t Offset, uint32_t TotalSize) {
   DataMemTotalSize = TotalSize;
   DataMemOffset = Offset;
   DataMemLimit = Offset + TotalSize;
-  DataMemory = std::unique_ptr<char[]>(new char[TotalSize]);
+
+  void* Memory = mmap(nullptr, TotalSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (Memory == MAP_FAILED) {
+    std::cerr << "Can't reserve " << TotalSize << " bytes for the guest data memory\n";
+    exit(1);
+  }
+  DataMemory = std::unique_ptr<char[], GuestMemoryDeleter>(static_cast<char*>(Memory), GuestMemoryDeleter{TotalSize});
+}
+
+// Gives the pages back to the host; the range reads as zero afterwards. The pages are replaced by a fresh
+// anonymous mapping, as MADV_DONTNEED would bring back the file content of pages mapped from input files.
+void Machine::releaseMemory(uint32_t Addrs, uint32_t Size) {
+  static const uintptr_t HostPageSize = sysconf(_SC_PAGESIZE);
+
+  char* Start = DataMemory.get() + (Addrs - DataMemOffset);
+  char* End   = Start + Size;
+  char* PageStart = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(Start) + HostPageSize - 1) & ~(HostPageSize - 1));
+  char* PageEnd   = reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(End) & ~(HostPageSize - 1));
+
+  if (PageStart >= PageEnd) {
+    std::memset(Start, 0, Size);
+    return;
+  }
+
+  std::memset(Start, 0, PageStart - Start);
+  std::memset(PageEnd, 0, End - PageEnd);
+  if (mmap(PageStart, PageEnd - PageStart, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+           -1, 0) == MAP_FAILED)
+    std::memset(PageStart, 0, PageEnd - PageStart);
+}
+
+// Linux semantics: the current break is returned when the request can't be satisfied
+uint32_t Machine::setBreak(uint32_t NewBreak) {
+  if (NewBreak < HeapBase || NewBreak > MapBottom)
+    return HeapBreak;
+
+  if (NewBreak < HeapBreak)
+    releaseMemory(NewBreak, HeapBreak - NewBreak);
+
+  HeapBreak = NewBreak;
+  PeakBreakUse = std::max(PeakBreakUse, HeapBreak - HeapBase);
+  return HeapBreak;
+}
+
+// Returns 0 when there is no room left between the break and the mappings
+uint32_t Machine::mapAnonymous(uint32_t Size) {
+  Size = alignToPage(Size);
+  if (Size == 0)
+    return 0;
+
+  uint32_t Addrs = 0;
+  for (auto It = FreeMappings.begin(); It != FreeMappings.end(); ++It) {
+    if (It->second < Size)
+      continue;
+
+    Addrs = It->first;
+    if (It->second > Size)
+      FreeMappings[Addrs + Size] = It->second - Size;
+    FreeMappings.erase(It);
+    break;
+  }
+
+  if (Addrs == 0) {
+    if (MapBottom - HeapBreak < Size)
+      return 0;
+    MapBottom -= Size;
+    Addrs = MapBottom;
+  }
+
+  MappedBytes += Size;
+  PeakMappedBytes = std::max(PeakMappedBytes, MappedBytes);
+  return Addrs;
+}
+
+void Machine::unmapAnonymous(uint32_t Addrs, uint32_t Size) {
+  Size = alignToPage(Size);
+  if (Addrs < MapBottom || Addrs + Size > HeapLimit || Size == 0)
+    return;
+
+  // Unmapping a range that is (partly) free already is a no-op
+  auto Overlap = FreeMappings.lower_bound(Addrs + Size);
+  if (Overlap != FreeMappings.begin() && std::prev(Overlap)->first + std::prev(Overlap)->second > Addrs)
+    return;
+
+  releaseMemory(Addrs, Size);
+  MappedBytes -= std::min(MappedBytes, Size);
+  FreeMappings[Addrs] = Size;
+
+  // Coalesce with the free neighbours and give the lowest free range back to the break
+  auto It = FreeMappings.find(Addrs);
+  auto Next = std::next(It);
+  if (Next != FreeMappings.end() && It->first + It->second == Next->first) {
+    It->second += Next->second;
+    FreeMappings.erase(Next);
+  }
+  if (It != FreeMappings.begin()) {
+    auto Prev = std::prev(It);
+    if (Prev->first + Prev->second == It->first) {
+      Prev->second += It->second;
+      FreeMappings.erase(It);
+      It = Prev;
+    }
+  }
+  if (It->first == MapBottom) {
+    MapBottom += It->second;
+    FreeMappings.erase(It);
+  }
 }
 
 void Machine::addDataMemory(uint32_t StartAddress, uint32_t Size, const char* DataBuffer) {
@@ -248,13 +368,26 @@ std::vector<uint32_t> Machine::getVectorOfMethodEntries() {
   return R;
 }
 
+// Maps the entry of each enabled guest routine to its host implementation
+void Machine::bindIntrinsics() {
+  IntrinsicEntries.clear();
+  for (auto& KV : Symbolls) {
+    const std::string& Name = KV.second.first;
+    if (EnabledIntrinsics.count(Name) == 0 && EnabledIntrinsics.count("all") == 0)
+      continue;
+    if (IntrinsicFn Fn = dbt::Intrinsics::getHostImpl(Name))
+      IntrinsicEntries[KV.first] = {Name, Fn};
+  }
+}
+
 using namespace ELFIO;
 
 void Machine::reset() {
   loadELF(BinPath);
 }
 
-int Machine::loadELF(const std::string ElfPath) {
+// CodeOnly loads the text and the symbols, for machines that only decode (no data, stack or registers)
+int Machine::loadELF(const std::string ElfPath, bool CodeOnly) {
   BinPath = ElfPath;
 
   elfio reader;
@@ -283,7 +416,21 @@ int Machine::loadELF(const std::string ElfPath) {
       Started = true;
   }
 
-  allocDataMemory(AddressOffset, (TotalDataSize + stackSize + heapSize) + (4 - (TotalDataSize + stackSize + heapSize) % 4));
+  if (!CodeOnly) {
+    // The whole guest address space above the data is reserved (MAP_NORESERVE, pages are committed on
+    // use), so the heap grows up to the stack. addDataMemory moves DataMemLimit past the reservation by
+    // TotalDataSize, which is left out to keep it within 32 bits.
+    allocDataMemory(AddressOffset, GUEST_MEMORY_TOP - AddressOffset - TotalDataSize);
+
+    HeapBase  = alignToPage(AddressOffset + TotalDataSize);
+    HeapLimit = (DataMemOffset + DataMemTotalSize - stackSize) & ~(GUEST_PAGE_SIZE - 1);
+    if (heapSize != 0)
+      HeapLimit = std::min(HeapLimit, (AddressOffset + TotalDataSize + heapSize) & ~(GUEST_PAGE_SIZE - 1));
+    HeapBreak = HeapBase;
+    MapBottom = HeapLimit;
+    FreeMappings.clear();
+    MappedBytes = PeakBreakUse = PeakMappedBytes = 0;
+  }
 
   std::unordered_map<uint32_t, std::string> SymbolNames;
   std::set<uint32_t> SymbolStartAddresses;
@@ -291,7 +438,7 @@ int Machine::loadELF(const std::string ElfPath) {
   Started = false;
   for (int i = 0; i < sec_num; ++i) {
     section* psec = reader.sections[i];
-    if (Started && (psec->get_flags() & 0x2) != 0 && psec->get_data() != nullptr) {
+    if (!CodeOnly && Started && (psec->get_flags() & 0x2) != 0 && psec->get_data() != nullptr) {
       addDataMemory(psec->get_address(), psec->get_size(), psec->get_data());
     }
 
@@ -320,13 +467,20 @@ int Machine::loadELF(const std::string ElfPath) {
     }
   }
 
+  Symbolls.clear();
   for (auto I = SymbolStartAddresses.begin(); I != SymbolStartAddresses.end(); ++I)
     Symbolls[*I] = {SymbolNames[*I], *SymbolStartAddresses.upper_bound(*I)};
 
+  if (CodeOnly)
+    return 1;
+
+  if (!EnabledIntrinsics.empty())
+    bindIntrinsics();
+
   for (int i = 0; i < 258; i++)
     Register[i] = 0;
 
-  uint32_t StackAddr = DataMemLimit-stackSize/4;
+  uint32_t StackAddr = DataMemOffset+DataMemTotalSize-stackSize/4;
   setRegister(29, StackAddr + (4 - StackAddr%4)); //StackPointer
   setRegister(30, StackAddr + (4 - StackAddr%4)); //StackPointer
 
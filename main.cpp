@@ -3,6 +3,11 @@
 #include <RFT.hpp>
 #include <manager.hpp>
 #include <syscall.hpp>
+#include <syscallLog.hpp>
+#include <aot.hpp>
+#include <pipelineModel.hpp>
+#include <profileDB.hpp>
+#include <staticCFG.hpp>
 #include <timer.hpp>
 #include <algorithm>
 
@@ -18,12 +23,14 @@ clarg::argString BinaryFlag("-bin",  "Path to the binary which will should be em
 clarg::argBool   PreheatFlag("-p",  "Run one time to compile all regions and then reexecute measuring the time.");
 clarg::argBool   VerboseFlag("-v",  "display the compiled regions");
 clarg::argBool   HelpFlag("-h",  "display the help message");
-clarg::argInt    RegionLimitSize("-l", "region size limit", 0);
+clarg::argInt    RegionLimitSize("-l", "region size limit (OI instructions), bigger regions are split", 0);
+clarg::argInt    RegionLimitIRSize("-lir", "region size limit (estimated LLVM IR instructions), bigger regions are split", 0);
 clarg::argString ToCompileFlag("-tc", "Functions to compile", "");
 clarg::argString ArgumentsFlag("-args", "Pass Parameters to binary file (as string)", "");
 clarg::argInt	 StackSizeFlag("-stack", "Set new stack size. (Default: 128mb)" , STACK_SIZE);
-clarg::argInt	 HeapSizeFlag ("-heap", "Set new heap size (Default: 128mb)", HEAP_SIZE);
-clarg::argInt	 NumThreadsFlag ("-threads", "Number of compilation threads (min 1)", 1);
+clarg::argInt	 HeapSizeFlag ("-heap", "Cap the heap size (Default: grows up to the stack, committed on use)", 0);
+clarg::argInt	 NumThreadsFlag ("-threads", "Number of compilation threads (min 1), used by -wc and -preload (default: all cores)", 1);
+clarg::argInt	 PreloadFlag ("-preload", "Compile the -lr/-loi regions in parallel and start emulating once this many of the first (hottest) are installed", 0);
 clarg::argString RegionPath ("-reg", "Set default path to load region files", "./");
 clarg::argBool   InlineFlag ("-inline", "Set the compiler to emit a LLVM function to each called function", "./");
 
@@ -35,9 +42,34 @@ clarg::argBool   DumpOIRegionsFlag("-doi", "Dump OI Regions to files");
 clarg::argBool   LoadRegionsFlag("-lr", "Load Regions (.bc) from files");
 clarg::argBool   LoadOIFlag("-loi", "Load Regions (.oi) from files");
 clarg::argBool   MergeOIFlag("-moi", "Merge OI Regions before dumping");
+clarg::argString RegionArchiveFlag("-archive", "Dump/load the regions to/from this single archive instead of r<N>.oi/.bc files", "");
 clarg::argString CustomOptsFlag("-opts", "path to regions optimization list file", "");
 clarg::argInt    ExecsFlag("-execs",  "number of times to execute a binary.", 1);
 clarg::argString BinariesFlag("-bins",  "File with list of binaries to be executed.", "");
+clarg::argString IntrinsicsFlag("-intrinsics", "Comma separated guest routines (memcpy, strlen, sqrt, ...) to run natively, or 'all'", "");
+clarg::argBool   LoopIdiomsFlag("-loop-idioms", "Emit guest copy/fill loops as memmove/memset (guarded)");
+clarg::argBool   VectorizeFlag("-vec", "Emit loop metadata and run the loop/SLP vectorizers on regions");
+clarg::argBool   MemPartitionsFlag("-mempart", "Tag register/stack/global accesses as noalias (runtime checked)");
+clarg::argBool   InRegionSyscallsFlag("-isys", "Serve syscalls from inside compiled regions instead of exiting to the interpreter");
+clarg::argInt    WriteBufferFlag("-bufio", "Combine guest writes to stdout/stderr/files in per fd buffers of this size (bytes)", 65536);
+clarg::argBool   MapInputFlag("-mmapio", "Map files the guest opens read only and serve its reads from the mapping. The size is taken at open: use on inputs nothing writes meanwhile (pages are remapped into the guest only for read-only mounts or immutable files)");
+clarg::argString RecordSyscallsFlag("-record", "Record the guest syscalls (results and written memory) to this file", "");
+clarg::argString ReplaySyscallsFlag("-replay", "Serve the guest syscalls from a log written by -record", "");
+clarg::argString BranchTraceFlag("-btrace", "Only interpret, recording the taken branches to this file (see oi-rftsim)", "");
+clarg::argInt    SpeculateFlag("-spec", "Compile up to this many statically found loops/functions before they get hot (low priority)", 64);
+clarg::argBool   AsyncRFTFlag("-async-rft", "Form regions in a profiler thread fed by a ring of branch events");
+clarg::argString AOTFlag("-aot", "Translate the methods reachable from the entry (plus the -loi regions in -reg) to this shared object and exit", "");
+clarg::argString AOTLoadFlag("-aotload", "Install the regions of a shared object written by -aot before running", "");
+clarg::argBool   PassStatsFlag("-pass-stats", "Time every optimization pass and print the per pass totals");
+clarg::argInt    CompileBudgetFlag("-cbudget", "Optimization time budget per region (ms): optional passes predicted to overrun it are skipped", 0);
+clarg::argInt    IPOLimitFlag("-ipo-limit", "Methods of a region are inlined in its entry unless it grows past this many IR insts (0: no module stage)", 20000);
+clarg::argString ModelFlag("-model", "Pick the passes of each region with this pipeline model (see -model-train)", "");
+clarg::argString ModelTrainFlag("-model-train", "Add the regions in -reg (.oi, or -archive) with their -opts passes to this model and exit", "");
+clarg::argString TuneFlag("-tune", "Search the passes of the hottest regions online and keep the winners in the -opts file <this>.<binary hash>", "");
+clarg::argInt    TuneRegionsFlag("-tune-regions", "Number of regions tuned by -tune", 8);
+clarg::argString ProfileDBFlag("-profdb", "Directory of the per binary profiles: warm start from and merge this run into them", "");
+clarg::argInt    ProfileHotFlag("-profdb-hot", "Profiled regions compiled before any new one (the rest compile speculatively)", 16);
+clarg::argString RegionCacheFlag("-rcache", "Directory where compiled regions are shared between binaries/runs", "");
 
 #ifdef DEBUG
 clarg::argInt debugFlag ("-d", "Set Debug Level. This value can be 1 or 2 (1 - Less verbosive; 2 - More Verbosive)", 1);
@@ -50,7 +82,7 @@ void usage(char* PrgName) {
   #endif
   cout << "\n\n";
   cout << "Usage: " << PrgName <<
-    " [-rft {net, net-r, mret2, lef, lei, netplus, netplus-e-r, mb}] [-interpret] -bin PathToBinary\n\n";
+    " [-rft {net, net-r, mret2, lef, lei, netplus, netplus-e-r, method, method-eager, mb}] [-interpret] -bin PathToBinary\n\n";
 
   cout << "DESCRIPTION:\n";
   cout << "This program implements the OpenISA DBT (Dynamic Binary Translator)\n" <<
@@ -120,6 +152,40 @@ emulateBinary(std::string file, uint32_t NumExecs, dbt::SyscallManager *SyscallM
   }
 
   TheManager.setDataMemOffset(M.getDataMemOffset());
+  if (TuneFlag.was_set())
+    TheManager.setTunedBinary(dbt::AOTCompiler::hashBinary(M));
+
+  std::vector<std::pair<uint32_t, OIInstList>> SpeculativeRegions;
+  if (AOTLoadFlag.was_set())
+    TheManager.setPreinstalledRegions(dbt::AOTCompiler::load(AOTLoadFlag.get_value(), M));
+
+  bool IsLoadingRegions = LoadRegionsFlag.was_set() || LoadOIFlag.was_set() || WholeCompilationFlag.was_set();
+  if (SpeculateFlag.was_set() && !InterpreterFlag.was_set() && !BranchTraceFlag.was_set() && !IsLoadingRegions) {
+    dbt::StaticCFG CFG(M);
+    unsigned MaxSize = RegionLimitSize.was_set() ? RegionLimitSize.get_value() : 1024;
+    SpeculativeRegions = CFG.getSpeculativeRegions(SpeculateFlag.get_value(), MaxSize);
+    std::cerr << "Static CFG: " << CFG.getNumOfLoops() << " loops, " << SpeculativeRegions.size() << " regions to compile speculatively\n";
+  }
+
+  // Regions recorded by the previous runs: the hottest go straight to the compiler, the rest are speculative
+  std::unique_ptr<dbt::ProfileDB> Profile;
+  std::vector<std::pair<uint32_t, OIInstList>> ProfiledRegions;
+  if (ProfileDBFlag.was_set() && !InterpreterFlag.was_set() && !BranchTraceFlag.was_set() && !IsLoadingRegions) {
+    Profile = std::make_unique<dbt::ProfileDB>(ProfileDBFlag.get_value(), M);
+    ProfiledRegions = Profile->getHotRegions();
+    std::cerr << "Profile: " << ProfiledRegions.size() << " regions from " << Profile->getNumOfRuns() << " runs\n";
+
+    size_t Hot = std::min<size_t>(ProfileHotFlag.get_value(), ProfiledRegions.size());
+    SpeculativeRegions.insert(SpeculativeRegions.begin(), ProfiledRegions.begin() + Hot, ProfiledRegions.end());
+    ProfiledRegions.resize(Hot);
+    TheManager.setProfile(Profile.get());
+  }
+
+  auto enqueueKnownRegions = [&]() {
+    for (auto& R : ProfiledRegions)
+      TheManager.addOIRegion(R.first, R.second);
+    TheManager.addSpeculativeRegions(SpeculativeRegions);
+  };
 
   dbt::Timer GlobalTimer;
 
@@ -129,9 +195,14 @@ emulateBinary(std::string file, uint32_t NumExecs, dbt::SyscallManager *SyscallM
 
     M.setPreheating(true);
     std::cerr << "Preheating...\n";
+    enqueueKnownRegions();
+
+    std::unique_ptr<dbt::RFT> Profiling;
+    if (Profile)
+      Profiling = std::make_unique<dbt::ProfileRFT>(TheManager, *RftChosen, *Profile);
 
     GlobalTimer.startClock();
-    dbt::ITDInterpreter I(*SyscallM, *RftChosen);
+    dbt::ITDInterpreter I(*SyscallM, Profiling ? *Profiling : *RftChosen);
     I.executeAll(M);
     GlobalTimer.stopClock();
 
@@ -151,7 +222,14 @@ emulateBinary(std::string file, uint32_t NumExecs, dbt::SyscallManager *SyscallM
     if(M.setCommandLineArguments(ArgumentsFlag.get_value()) < 0)
         exit(1);
 
-    dbt::ITDInterpreter I(*SyscallM, *RftChosen);
+    // Every execution starts cold (TheManager.reset); entries still compiled from the preheat are skipped
+    enqueueKnownRegions();
+
+    std::unique_ptr<dbt::RFT> Profiling;
+    if (Profile)
+      Profiling = std::make_unique<dbt::ProfileRFT>(TheManager, *RftChosen, *Profile);
+
+    dbt::ITDInterpreter I(*SyscallM, Profiling ? *Profiling : *RftChosen);
     TheManager.incExecCount();
     std::cerr << "Starting execution:\n";
 
@@ -172,6 +250,12 @@ emulateBinary(std::string file, uint32_t NumExecs, dbt::SyscallManager *SyscallM
   if (PreheatFlag.was_set()) {
       delete RftChosen;
   }
+
+  if (Profile) {
+    TheManager.setProfile(nullptr);
+    if (Profile->write())
+      std::cerr << "Profile: " << Profile->getNumOfRegions() << " regions saved\n";
+  }
 }
 
 std::unordered_map<uint32_t, std::vector<std::string>>* loadCustomOpts(std::string CustomOptsPath) {
@@ -188,7 +272,8 @@ std::unordered_map<uint32_t, std::vector<std::string>>* loadCustomOpts(std::stri
   while (std::getline(File, Line)) {
     std::istringstream ISS(Line);
     uint32_t EntryAddrs;
-    ISS >> EntryAddrs;
+    if (!(ISS >> EntryAddrs))
+      continue;
 
     std::string OPT;
     while (ISS >> OPT) (*CustomOpts)[EntryAddrs].push_back(OPT);
@@ -226,6 +311,73 @@ int main(int argc, char** argv) {
     M.setHeapSize(HeapSizeFlag.get_value());
   }
 
+  if (IntrinsicsFlag.was_set()) {
+    std::set<std::string> Names;
+    std::istringstream ISS(IntrinsicsFlag.get_value());
+    std::string Name;
+    while (std::getline(ISS, Name, ','))
+      if (Name != "")
+        Names.insert(Name);
+
+    dbt::Intrinsics::registerHostSymbols();
+    M.setEnabledIntrinsics(Names);
+  }
+
+  if (AOTFlag.was_set()) {
+    if (!M.loadELF(BinaryFlag.get_value())) {
+      std::cerr << "Can't find or process ELF file " << BinaryFlag.get_value() << std::endl;
+      return 2;
+    }
+
+    std::vector<std::pair<uint32_t, OIInstList>> Regions;
+    std::set<uint32_t> Roots;
+    dbt::StaticCFG CFG(M);
+    Roots.insert(CFG.getMethod(M.getPC()));
+
+    if (LoadOIFlag.was_set()) {
+      if (RegionArchiveFlag.was_set()) {
+        dbt::RegionArchive Archive(RegionArchiveFlag.get_value());
+        for (auto Entry : Archive.getEntries())
+          Regions.push_back({Entry, Archive.getRegion(Entry)});
+      } else {
+        Regions = dbt::AOTCompiler::readProfile(RegionPath.get_value());
+      }
+      for (auto& R : Regions)
+        Roots.insert(CFG.getMethod(R.first));
+    }
+
+    for (auto& R : CFG.getReachableMethods(Roots))
+      Regions.push_back(R);
+
+    return dbt::AOTCompiler::compile(M, Regions, AOTFlag.get_value(), VerboseFlag.was_set()) ? 0 : 1;
+  }
+
+  if (ModelTrainFlag.was_set()) {
+    if (!CustomOptsFlag.was_set()) {
+      std::cerr << "-model-train needs the passes of the regions (-opts)\n";
+      return 1;
+    }
+
+    std::vector<std::pair<uint32_t, OIInstList>> Regions;
+    if (RegionArchiveFlag.was_set()) {
+      dbt::RegionArchive Archive(RegionArchiveFlag.get_value());
+      for (auto Entry : Archive.getEntries())
+        Regions.push_back({Entry, Archive.getRegion(Entry)});
+    } else {
+      Regions = dbt::AOTCompiler::readProfile(RegionPath.get_value());
+    }
+
+    dbt::PipelineModel Model;
+    Model.load(ModelTrainFlag.get_value());
+    auto Opts = loadCustomOpts(CustomOptsFlag.get_value());
+    for (auto& R : Regions)
+      if (Opts->count(R.first) != 0 && !R.second.empty())
+        Model.addSample(R.second, (*Opts)[R.first]);
+
+    std::cerr << "Pipeline model: " << Model.getNumOfSamples() << " samples of " << Model.getNumOfPipelines() << " pipelines\n";
+    return Model.write(ModelTrainFlag.get_value()) ? 0 : 1;
+  }
+
   dbt::Manager TheManager(M, VerboseFlag.was_set(), InlineFlag.was_set());
 
   if (LoadRegionsFlag.was_set() || LoadOIFlag.was_set() || WholeCompilationFlag.was_set())
@@ -238,7 +390,60 @@ int main(int argc, char** argv) {
     TheManager.setOptPolicy(dbt::Manager::OptPolitic::Normal);
   }
 
+  // Whole compilation is partitioned over every core unless told otherwise
+  if (NumThreadsFlag.was_set())
+    TheManager.setNumOfThreads(NumThreadsFlag.get_value());
+  else if (WholeCompilationFlag.was_set() || PreloadFlag.was_set())
+    TheManager.setNumOfThreads(std::thread::hardware_concurrency());
+
+  // Loaded regions go through the workers when there is more than one or the emulation has to wait for them
+  bool IsLoading = LoadRegionsFlag.was_set() || LoadOIFlag.was_set();
+  if (IsLoading && !WholeCompilationFlag.was_set() && (PreloadFlag.was_set() || NumThreadsFlag.get_value() > 1))
+    TheManager.setPreload(true, PreloadFlag.get_value());
+
+  if (LoopIdiomsFlag.was_set())
+    TheManager.setLoopIdioms(true);
+
+  if (VectorizeFlag.was_set())
+    TheManager.setVectorize(true);
+
+  if (MemPartitionsFlag.was_set())
+    TheManager.setMemoryPartitions(true);
+
+  if (InRegionSyscallsFlag.was_set())
+    TheManager.setInRegionSyscalls(true);
+
+  if (IPOLimitFlag.was_set())
+    dbt::IROpt::setIPOSizeLimit(IPOLimitFlag.get_value());
+
+  if (PassStatsFlag.was_set())
+    dbt::IROpt::setPassTiming(true);
+
+  if (CompileBudgetFlag.was_set())
+    dbt::IROpt::setCompileBudget(CompileBudgetFlag.get_value());
+
+  if (ModelFlag.was_set()) {
+    if (CustomOptsFlag.was_set())
+      std::cerr << "-model is ignored with -opts\n";
+    else if (!TheManager.setPipelineModel(ModelFlag.get_value()))
+      std::cerr << "Can't load the pipeline model " << ModelFlag.get_value() << "\n";
+  }
+
+  if (TuneFlag.was_set()) {
+    if (CustomOptsFlag.was_set())
+      std::cerr << "-tune is ignored with -opts\n";
+    else
+      TheManager.setAutotuner(TuneFlag.get_value(), TuneRegionsFlag.get_value());
+  }
+
+  if (RegionArchiveFlag.was_set())
+    TheManager.setRegionArchive(RegionArchiveFlag.get_value());
+
+  if (RegionCacheFlag.was_set())
+    TheManager.setRegionCache(RegionCacheFlag.get_value());
+
   TheManager.startCompilationThr();
+  TheManager.waitForPreload();
 
   if (InterpreterFlag.was_set()) {
     RftChosen = std::make_unique<dbt::NullRFT>(TheManager);
@@ -249,33 +454,20 @@ int main(int argc, char** argv) {
     if (LoadRegionsFlag.was_set() || LoadOIFlag.was_set() || WholeCompilationFlag.was_set()) {
       std::cerr << "Preheated RFT Selected\n";
       RftChosen = std::make_unique<dbt::PreheatRFT>(TheManager);
-    } else if (RFTName == "net") {
-      std::cerr << "NET RFT Selected\n";
-      RftChosen = std::make_unique<dbt::NET>(TheManager);
-    } else if (RFTName == "net-r") {
-      std::cerr << "NET-R RFT Selected\n";
-      RftChosen = std::make_unique<dbt::NET>(TheManager, true);
-    } else if (RFTName == "mret2") {
-      std::cerr << "MRET2 RFT Selected\n";
-      RftChosen = std::make_unique<dbt::MRET2>(TheManager);
-    } else if (RFTName == "netplus") {
-      std::cerr << "NETPlus RFT Selected\n";
-      RftChosen = std::make_unique<dbt::NETPlus>(TheManager);
-    } else if (RFTName == "netplus-c") {
-      std::cerr << "NETPlus-c RFT Selected\n";
-      RftChosen = std::make_unique<dbt::NETPlus>(TheManager, false, true);
-    } else if (RFTName == "netplus-e-r") {
-      std::cerr << "NETPlus-e-r RFT Selected\n";
-      RftChosen = std::make_unique<dbt::NETPlus>(TheManager, true);
-    } else if (RFTName == "netplus-e-r-c") {
-      std::cerr << "NETPlus-e-r-c RFT Selected\n";
-      RftChosen = std::make_unique<dbt::NETPlus>(TheManager, true, true);
     } else {
-      std::cerr << "You should select a valid RFT!\n";
-      return 1;
+      RftChosen = dbt::RFT::create(RFTName, TheManager);
+      if (!RftChosen) {
+        std::cerr << "You should select a valid RFT!\n";
+        return 1;
+      }
     }
   }
 
+  if (BranchTraceFlag.was_set()) {
+    std::cerr << "Recording the branch trace to " << BranchTraceFlag.get_value() << " (no regions are formed)\n";
+    RftChosen = std::make_unique<dbt::TraceRFT>(TheManager, BranchTraceFlag.get_value());
+  }
+
   if(HotnessFlag.was_set()) {
     std::cerr << "The Hotness Threshold was set to " << HotnessFlag.get_value() << std::endl;
     RftChosen->setHotnessThreshold(HotnessFlag.get_value());
@@ -284,8 +476,27 @@ int main(int argc, char** argv) {
   if (RegionLimitSize.was_set())
     RftChosen->setRegionLimitSize(RegionLimitSize.get_value());
 
+  if (RegionLimitIRSize.was_set())
+    RftChosen->setRegionLimitIRSize(RegionLimitIRSize.get_value());
+
+  if (AsyncRFTFlag.was_set() && !InterpreterFlag.was_set() && !BranchTraceFlag.was_set())
+    RftChosen = std::make_unique<dbt::AsyncRFT>(TheManager, std::move(RftChosen));
+
   std::unique_ptr<dbt::SyscallManager> SyscallM;
-  SyscallM = std::make_unique<dbt::LinuxSyscallManager>();
+  auto LinuxSyscallM = std::make_unique<dbt::LinuxSyscallManager>();
+  if (WriteBufferFlag.was_set())
+    LinuxSyscallM->setWriteBufferSize(WriteBufferFlag.get_value());
+  if (MapInputFlag.was_set())
+    LinuxSyscallM->setMapInputFiles(true);
+  SyscallM = std::move(LinuxSyscallM);
+
+  if (RecordSyscallsFlag.was_set())
+    SyscallM = std::make_unique<dbt::RecordingSyscallManager>(RecordSyscallsFlag.get_value(), std::move(SyscallM));
+  else if (ReplaySyscallsFlag.was_set())
+    SyscallM = std::make_unique<dbt::ReplaySyscallManager>(ReplaySyscallsFlag.get_value(), std::move(SyscallM));
+
+  if (InRegionSyscallsFlag.was_set())
+    SyscallM->setAsRegionSyscallHandler(M);
 
   if (BinaryFlag.was_set()) {
     emulateBinary(BinaryFlag.get_value(), ExecsFlag.get_value(), SyscallM.get(), TheManager, M, RftChosen.get());
@@ -2,12 +2,16 @@
 #include <OIPrinter.hpp>
 #include <fstream>
 #include <vector>
+#include <x86intrin.h>
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/raw_ostream.h"
 #include "timer.hpp"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
 
 using namespace dbt;
 
@@ -28,25 +32,85 @@ llvm::Module* Manager::loadRegionFromFile(std::string Path) {
 
 bool compInst(std::array<uint32_t, 2> A, std::array<uint32_t, 2> B) { return (A[0]<B[0]); }
 
+llvm::Module* Manager::loadRegionFromArchive(uint32_t Entry) {
+  if (!Archive->hasRegion(Entry))
+    return nullptr;
+
+  auto M = llvm::parseBitcodeFile(llvm::MemoryBufferRef(Archive->getBitcode(Entry), "r" + std::to_string(Entry)), TheContext);
+  if (!M) {
+    llvm::consumeError(M.takeError());
+    return nullptr;
+  }
+  return M->release();
+}
+
+void Manager::dumpRegionArchive(bool MergeRegions, bool OnlyOI) {
+  if (!OnlyOI && MergeRegions) {
+    std::cerr << "Merging OI regions!\n";
+    mergeOIRegions();
+  }
+
+  RegionArchiveWriter Writer;
+  std::set<uint32_t> Written;
+  auto addRegion = [&](uint32_t Entry) {
+    if (CompiledOIRegions.count(Entry) == 0 || !Written.insert(Entry).second)
+      return;
+
+    std::string Bitcode;
+    if (!OnlyOI && IRRegions.count(Entry) != 0) {
+      llvm::raw_string_ostream OS(Bitcode);
+      WriteBitcodeToFile(*IRRegions[Entry], OS);
+      OS.flush();
+    }
+
+    std::vector<std::string> Opts;
+    if (OptMode == OptPolitic::Custom && CustomOpts->count(Entry) != 0)
+      Opts = (*CustomOpts)[Entry];
+    Writer.add(Entry, CompiledOIRegions[Entry], Bitcode, Opts);
+  };
+
+  // Compiled regions in the order they were formed, then the ones that never got compiled
+  for (auto Entry : IRRegionsKey)
+    addRegion(Entry);
+  for (auto& R : CompiledOIRegions)
+    addRegion(R.first);
+
+  std::cerr << "Dumping regions to " << ArchivePath << "\n";
+  Writer.write(ArchivePath);
+}
+
 void Manager::loadRegionsFromFiles() {
-  std::ifstream infile(RegionPath + "regions.order");
-  std::string line;
-  std::cout << "Loading Regions from " << RegionPath << "regions.order\n";
-  while (std::getline(infile, line)) {
-    uint32_t Entry = std::stoi(line);
-    if (!IsToLoadBCFormat) {
-      std::ifstream infile(RegionPath + "r"+std::to_string(Entry)+".oi");
-      std::string line;
-      OIInstList Insts;
-      while (std::getline(infile, line)) {
-        std::istringstream iss(line);
-        uint32_t Addrs, Opcode;
-        if (!(iss >> Addrs >> Opcode)) { break; }
-        Insts.push_back({Addrs, Opcode});
-      }
-      addOIRegion(Entry, Insts);
-    } else {
-      addOIRegion(Entry, {{Entry, 0}});
+  if (!ArchivePath.empty()) {
+    Archive = std::make_unique<RegionArchive>(ArchivePath);
+    std::cout << "Loading Regions from " << ArchivePath << "\n";
+    for (auto Entry : Archive->getEntries()) {
+      if (IsToPreload)
+        PreloadEntries.push_back(Entry);
+      else if (!IsToLoadBCFormat)
+        addOIRegion(Entry, Archive->getRegion(Entry));
+      else
+        addOIRegion(Entry, {{Entry, 0}});
+
+      auto Opts = Archive->getOpts(Entry);
+      if (!Opts.empty())
+        ArchivedOpts[Entry] = Opts;
+    }
+
+    // The optimization lists recorded with the regions apply unless -opts was given
+    if (!ArchivedOpts.empty() && OptMode != OptPolitic::Custom)
+      setCustomOpts(&ArchivedOpts);
+  } else {
+    std::ifstream infile(RegionPath + "regions.order");
+    std::string line;
+    std::cout << "Loading Regions from " << RegionPath << "regions.order\n";
+    while (std::getline(infile, line)) {
+      uint32_t Entry = std::stoi(line);
+      if (IsToPreload)
+        PreloadEntries.push_back(Entry);
+      else if (!IsToLoadBCFormat)
+        addOIRegion(Entry, readOIRegion(Entry));
+      else
+        addOIRegion(Entry, {{Entry, 0}});
     }
   }
 
@@ -62,6 +126,17 @@ void Manager::loadRegionsFromFiles() {
       }
     }
 
+    if (NumOfThreads > 1) {
+      OIRegionsMtx.lock();
+      std::sort(OIAll.begin(), OIAll.end(), compInst);
+      partitionWholeRegion(OIAll, OIRegionsKey);
+      OIRegions.clear();
+      OIRegionsKey.clear();
+      NumOfOIRegions = 0;
+      OIRegionsMtx.unlock();
+      return;
+    }
+
     OIRegionsMtx.lock();
 		std::sort(OIAll.begin(), OIAll.end(), compInst);
     OIRegions.clear();
@@ -76,30 +151,332 @@ void Manager::loadRegionsFromFiles() {
 
 static unsigned int ModuleId = 0;
 
+// One partition per method holding loaded entries: the merged instructions of the method, compiled once
+// with all its entries.
+void Manager::partitionWholeRegion(const OIInstList& OIAll, const std::vector<uint32_t>& Entries) {
+  std::vector<uint32_t> Methods = TheMachine.getVectorOfMethodEntries();
+  std::sort(Methods.begin(), Methods.end());
+  auto getMethod = [&](uint32_t Addrs) {
+    auto It = std::upper_bound(Methods.begin(), Methods.end(), Addrs);
+    return It == Methods.begin() ? 0 : *(It - 1);
+  };
+
+  std::unordered_map<uint32_t, OIInstList> ByMethod;
+  for (auto I : OIAll)
+    ByMethod[getMethod(I[0])].push_back(I);
+
+  // Methods keep the order of their first entry
+  WholePartitions.clear();
+  std::unordered_map<uint32_t, size_t> Partition;
+  std::set<uint32_t> Seen;
+  for (auto Entry : Entries) {
+    uint32_t Method = getMethod(Entry);
+    if (!Seen.insert(Entry).second || ByMethod.count(Method) == 0)
+      continue;
+
+    if (Partition.count(Method) == 0) {
+      Partition[Method] = WholePartitions.size();
+      WholePartitions.push_back({{}, ByMethod[Method]});
+    }
+    WholePartitions[Partition[Method]].first.push_back(Entry);
+  }
+}
+
+// Passes given by -opts, then the ones tuned online, then the ones predicted by the model, else the default
+void Manager::optimizeRegion(IROpt& O, llvm::Module* M, uint32_t Entry, const std::vector<uint32_t>& Entries,
+                             const OIInstList& OIRegion) {
+  O.optimizeModule(M, Entries);
+
+  if (OptMode == OptPolitic::Custom) {
+    if (CustomOpts->count(Entry) != 0)
+      O.customOptimizeIRFunction(M, (*CustomOpts)[Entry]);
+    return;
+  }
+
+  std::vector<std::string> TunedOpts;
+  if (Tuner && Tuner->getBest(Entry, TunedOpts)) {
+    O.customOptimizeIRFunction(M, TunedOpts);
+    return;
+  }
+
+  if (Model) {
+    if (auto Predicted = Model->predict(OIRegion)) {
+      O.customOptimizeIRFunction(M, *Predicted);
+      PredictedRegions += 1;
+      // The tuner measures these passes as the region's first candidate
+      if (Tuner)
+        Tuner->setFirstPasses(Entry, *Predicted);
+      return;
+    }
+  }
+
+  O.optimizeIRFunction(M, IsToVectorize ? IROpt::OptLevel::Vector : IROpt::OptLevel::Basic,
+      Entry, 1, TheMachine.getBinPath());
+}
+
+OIInstList Manager::readOIRegion(uint32_t Entry) {
+  if (Archive)
+    return Archive->hasRegion(Entry) ? Archive->getRegion(Entry) : OIInstList();
+
+  std::ifstream infile(RegionPath + "r"+std::to_string(Entry)+".oi");
+  std::string line;
+  OIInstList Insts;
+  while (std::getline(infile, line)) {
+    std::istringstream iss(line);
+    uint32_t Addrs, Opcode;
+    if (!(iss >> Addrs >> Opcode)) { break; }
+    Insts.push_back({Addrs, Opcode});
+  }
+  return Insts;
+}
+
+// Workers read (or generate and optimize) each region and emit it as an object on their own LLVM context and
+// target machine. All the objects of a batch are added to the JIT before any is looked up, so calls between
+// its regions (to entries that are methods) are emitted as direct calls and resolved when they are linked.
+// A job is one module with all its entries; regions with an empty OIInstList are read by the workers
+// (-lr/-loi preloading, one entry per job).
+void Manager::compileInParallel(const std::vector<std::pair<std::vector<uint32_t>, OIInstList>>& Jobs,
+                                bool FromBitcode) {
+  if (Jobs.empty())
+    return;
+
+  auto Start = std::chrono::steady_clock::now();
+
+  if (PlannedRegions == nullptr)
+    PlannedRegions = static_cast<uint64_t*>(calloc(NATIVE_REGION_SIZE, sizeof(uint64_t)));
+  for (auto& J : Jobs)
+    for (auto Entry : J.first)
+      if (Entry < NATIVE_REGION_SIZE)
+        PlannedRegions[Entry] = 1;
+  // AOT entries are installed, calls to them bind to their addresses (their names are local to the shared object)
+  for (auto& R : PreinstalledRegions)
+    if (PlannedRegions[R.first] == 0)
+      PlannedRegions[R.first] = R.second;
+
+  std::vector<std::pair<std::vector<uint32_t>, std::unique_ptr<llvm::MemoryBuffer>>> Objects;
+  std::set<uint32_t> Callees;
+  std::mutex ObjectsMtx;
+  std::atomic<size_t> Next{0};
+
+  auto Worker = [&]() {
+    IREmitter WIRE;
+    std::unique_ptr<llvm::TargetMachine> TM(llvm::EngineBuilder().selectTarget());
+
+    // IROpt binds its pass managers to the first module it optimizes
+    std::unique_ptr<llvm::Module> First;
+    IROpt WIRO;
+    WIRO.setTargetMachine(TM.get());
+    WIRE.setLoopIdioms(IsToEmitLoopIdioms);
+    WIRE.setLoopMetadata(IsToVectorize);
+    WIRE.setMemoryPartitions(IsToPartitionMemory);
+    WIRE.setInRegionSyscalls(IsToEmitInRegionSyscalls);
+
+    for (size_t I = Next++; I < Jobs.size() && isRunning; I = Next++) {
+      const std::vector<uint32_t>& Entries = Jobs[I].first;
+      uint32_t Entry = Entries[0];
+      OIInstList OIRegion = Jobs[I].second;
+      if (OIRegion.empty())
+        OIRegion = FromBitcode && !Archive ? OIInstList{{Entry, 0}} : readOIRegion(Entry);
+
+      std::unique_ptr<llvm::Module> Mod;
+      if (FromBitcode) {
+        if (Archive && Archive->hasRegion(Entry)) {
+          auto M = llvm::parseBitcodeFile(llvm::MemoryBufferRef(Archive->getBitcode(Entry), "r" + std::to_string(Entry)),
+                                          WIRE.getContext());
+          if (M)
+            Mod = std::move(*M);
+          else
+            llvm::consumeError(M.takeError());
+        } else if (!Archive) {
+          llvm::SMDiagnostic Error;
+          Mod = llvm::parseIRFile(RegionPath + "r" + std::to_string(Entry) + ".bc", Error, WIRE.getContext());
+        }
+      } else if (!OIRegion.empty()) {
+        Mod = llvm::make_unique<llvm::Module>(std::to_string(Entry), WIRE.getContext());
+        WIRE.generateRegionIR(Entries, OIRegion, DataMemOffset, TheMachine, *TM, PlannedRegions, Mod.get());
+
+        optimizeRegion(WIRO, Mod.get(), Entry, Entries, OIRegion);
+      }
+
+      if (!Mod)
+        continue;
+
+      std::vector<uint32_t> Installable;
+      for (auto E : Entries) {
+        llvm::Function* F = Mod->getFunction("r" + std::to_string(E));
+        if (F != nullptr && !F->isDeclaration() && !IREmitter::isSelfReturning(F, E))
+          Installable.push_back(E);
+      }
+
+      if (!Installable.empty()) {
+        llvm::SmallVector<char, 0> Buffer;
+        llvm::raw_svector_ostream OS(Buffer);
+        llvm::legacy::PassManager PM;
+        TM->addPassesToEmitFile(PM, OS, nullptr, llvm::TargetMachine::CGFT_ObjectFile);
+        PM.run(*Mod);
+
+        std::lock_guard<std::mutex> Lock(ObjectsMtx);
+        Objects.push_back({Installable, llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(Buffer.data(), Buffer.size()),
+                                                                             "r" + std::to_string(Entry))});
+        for (auto& G : *Mod) {
+          uint32_t Callee;
+          if (G.isDeclaration() && G.getName().startswith("r") && !G.getName().drop_front(1).getAsInteger(10, Callee))
+            Callees.insert(Callee);
+        }
+        OICompiled += OIRegion.size();
+
+        CompiledOIRegionsMtx.lock();
+        for (auto E : Installable)
+          CompiledOIRegions[E] = OIRegion;
+        CompiledOIRegionsMtx.unlock();
+      }
+
+      if (!First)
+        First = std::move(Mod);
+    }
+  };
+
+  std::vector<std::thread> Workers;
+  for (unsigned I = 0; I < NumOfThreads; I++)
+    Workers.push_back(std::thread(Worker));
+  for (auto& W : Workers)
+    W.join();
+
+  if (!isRunning)
+    return;
+
+  NativeRegionsMtx.lock();
+  std::map<uint32_t, llvm::orc::VModuleKey> Emitted;
+  for (auto& O : Objects) {
+    auto Key = IRJIT->addObject(std::move(O.second));
+    for (auto Entry : O.first)
+      Emitted[Entry] = Key;
+  }
+
+  // Regions called directly but not available (dropped, or not loaded) leave to the interpreter at their entry
+  for (auto& J : Jobs)
+    Callees.insert(J.first.begin(), J.first.end());
+
+  llvm::LLVMContext StubContext;
+  auto Stubs = llvm::make_unique<llvm::Module>("stubs", StubContext);
+  Stubs->setDataLayout(IRJIT->getTargetMachine().createDataLayout());
+  std::vector<uint32_t> Dropped;
+  for (auto Callee : Callees) {
+    if (Emitted.count(Callee) != 0 || (Callee < NATIVE_REGION_SIZE && NativeRegions[Callee] != 0))
+      continue;
+    llvm::Type* I32 = llvm::Type::getInt32Ty(StubContext);
+    llvm::Type* I32Ptr = llvm::Type::getInt32PtrTy(StubContext);
+    auto FT = llvm::FunctionType::get(I32, {I32Ptr, I32Ptr, I32}, false);
+    auto F = llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage, "r" + std::to_string(Callee), Stubs.get());
+    llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(StubContext, "entry", F));
+    Builder.CreateRet(llvm::ConstantInt::get(I32, Callee));
+    Dropped.push_back(Callee);
+  }
+  if (!Dropped.empty()) {
+    IRJIT->addModule(std::move(Stubs));
+    IRJIT->findSymbol("r" + std::to_string(Dropped[0])).getAddress();
+  }
+
+  for (auto& E : Emitted) {
+    uint32_t Entry = E.first;
+    auto Addr = IRJIT->findSymbolIn(E.second, "r" + std::to_string(Entry)).getAddress();
+    if (!Addr) {
+      std::cerr << Entry << " was not successfully compiled!\n";
+      continue;
+    }
+    NativeRegions[Entry] = static_cast<intptr_t>(*Addr);
+    CompiledRegions += 1;
+
+    *PerfMapFile << std::hex << "0x" << *Addr << std::dec << " " << IREmitter::getAssemblySize((const void*) *Addr)
+      << " r" << Entry << ".oi\n";
+  }
+  PerfMapFile->flush();
+  NativeRegionsMtx.unlock();
+
+  std::cerr << "Parallel compilation: " << Emitted.size() << " regions in " << Objects.size() << " of " << Jobs.size()
+    << " modules on " << NumOfThreads << " threads in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count()
+    << " ms\n";
+}
+
+// The hottest (first loaded) PreloadCount regions are installed before the emulation is let go
+void Manager::preloadInParallel() {
+  size_t Hot = std::min<size_t>(PreloadCount, PreloadEntries.size());
+  std::vector<std::pair<std::vector<uint32_t>, OIInstList>> Jobs;
+  for (size_t I = 0; I < Hot; I++)
+    Jobs.push_back({{PreloadEntries[I]}, {}});
+  compileInParallel(Jobs, IsToLoadBCFormat);
+
+  PreloadMtx.lock();
+  IsPreloaded = true;
+  PreloadMtx.unlock();
+  PreloadCV.notify_all();
+
+  Jobs.clear();
+  for (size_t I = Hot; I < PreloadEntries.size(); I++)
+    Jobs.push_back({{PreloadEntries[I]}, {}});
+  compileInParallel(Jobs, IsToLoadBCFormat);
+}
+
 void Manager::runPipeline() {
   if (!IRE) {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
     llvm::InitializeNativeTargetAsmParser();
     IRJIT = llvm::make_unique<llvm::orc::IRJIT>();
+    IRJIT->setNativeRegions(NativeRegions, NATIVE_REGION_SIZE);
   }
 
   PerfMapFile = new std::ofstream("/tmp/perf-"+std::to_string(getpid())+".map");
 
   IRE = llvm::make_unique<IREmitter>();
   IRO = llvm::make_unique<IROpt>();
+  IRE->setLoopIdioms(IsToEmitLoopIdioms);
+  IRE->setLoopMetadata(IsToVectorize);
+  IRE->setMemoryPartitions(IsToPartitionMemory);
+  IRE->setInRegionSyscalls(IsToEmitInRegionSyscalls);
+  IRO->setTargetMachine(&IRJIT->getTargetMachine());
+
+  // A region compiled with other emitter or optimizer settings is never reused (in-region syscalls need
+  // the syscall manager, for instance)
+  uint64_t CacheConfig = RegionCache::hashConfig({IsToEmitLoopIdioms, IsToVectorize, IsToPartitionMemory,
+      IsToEmitInRegionSyscalls, static_cast<uint32_t>(OptMode), IROpt::getIPOSizeLimit(),
+      IROpt::getCompileBudget() > 0});
+
+  if (!WholePartitions.empty() || !PreloadEntries.empty()) {
+    if (!WholePartitions.empty())
+      compileInParallel(WholePartitions, false);
+    else
+      preloadInParallel();
+    PerfMapFile->close();
+    isFinished = true;
+    return;
+  }
 
   while (isRunning) {
     uint32_t EntryAddress;
     OIInstList OIRegion;
     
     std::unique_lock<std::mutex> lk(NR);
-    cv.wait(lk, [&]{ return getNumOfOIRegions() != 0; });
+    cv.wait(lk, [&]{ return getNumOfOIRegions() != 0 || NumOfSpeculative != 0 || (Tuner && Tuner->hasJobs()); });
 
-    OIRegionsMtx.lock_shared();
-    EntryAddress = OIRegionsKey.front();
-    OIRegion     = OIRegions[EntryAddress];
-    OIRegionsMtx.unlock_shared();
+    // Tuning candidates only take the compiler when no new region waits for it
+    Autotuner::Job Job;
+    if (getNumOfOIRegions() == 0 && NumOfSpeculative == 0 && Tuner && Tuner->takeJob(Job)) {
+      compileTuningCandidate(Job);
+      continue;
+    }
+
+    // Speculative regions don't count in NumOfOIRegions, so they never hold the RFTs back
+    bool IsSpeculative = getNumOfOIRegions() == 0;
+    if (IsSpeculative) {
+      if (!takeSpeculativeRegion(EntryAddress, OIRegion))
+        continue;
+    } else {
+      OIRegionsMtx.lock_shared();
+      EntryAddress = OIRegionsKey.front();
+      OIRegion     = OIRegions[EntryAddress];
+      OIRegionsMtx.unlock_shared();
+    }
 
     llvm::Module* Module = nullptr;
     unsigned Size  = 1;
@@ -109,10 +486,30 @@ void Manager::runPipeline() {
       continue;
 
     if (IsToLoadRegions && IsToLoadBCFormat)
-      Module = loadRegionFromFile("r"+std::to_string(EntryAddress)+".bc");
+      Module = Archive ? loadRegionFromArchive(EntryAddress) : loadRegionFromFile("r"+std::to_string(EntryAddress)+".bc");
 
     std::vector<uint32_t> EntryAddresses = {EntryAddress};
 
+    // Custom optimized regions are specific to this binary and whole compilation merges every region
+    uint64_t RegionHash = 0;
+    bool UseCache = RCache && Module == nullptr && OptMode != OptPolitic::Custom && !IsToDoWholeCompilation;
+    if (UseCache) {
+      RegionHash = RegionCache::hashRegion(EntryAddress, OIRegion, DataMemOffset, TheMachine, CacheConfig);
+      Module = RCache->lookup(RegionHash, EntryAddress, TheContext);
+
+      if (Module != nullptr) {
+        CompiledOIRegionsMtx.lock();
+        CompiledOIRegions[EntryAddress] = OIRegion;
+        CompiledOIRegionsMtx.unlock();
+
+        if (VerboseOutput)
+          std::cerr << "Region " << std::hex << EntryAddress << " found in the region cache\n";
+      }
+    }
+
+    bool Emitted = Module == nullptr;
+    auto CompileStart = std::chrono::steady_clock::now();
+
     if (Module == nullptr) {
       if (!isRunning) return;
 
@@ -143,6 +540,8 @@ void Manager::runPipeline() {
       if (VerboseOutput)
         std::cerr << "Generating IR for: " << std::hex <<  EntryAddress  << "...";
 
+      // Only regions going to the cache pay for relocatable code, the others are optimized with their addresses bound
+      IRE->setRelocatable(UseCache);
       IRE->generateRegionIR(EntryAddresses, OIRegion, DataMemOffset, TheMachine, IRJIT->getTargetMachine(),
                           NativeRegions, Module);
 
@@ -155,10 +554,20 @@ void Manager::runPipeline() {
 
       if (!isRunning) return;
 
-      if (OptMode != OptPolitic::Custom)
-        IRO->optimizeIRFunction(Module, IROpt::OptLevel::Basic, EntryAddress, 1, TheMachine.getBinPath());
-      else if (CustomOpts->count(EntryAddress) != 0)
-        IRO->customOptimizeIRFunction(Module, (*CustomOpts)[EntryAddress]);
+      optimizeRegion(*IRO, Module, EntryAddress, EntryAddresses, OIRegion);
+
+      if (IsToVectorize) {
+        for (auto Header : IROpt::getVectorizedLoops(Module)) {
+          VectorizedLoops += 1;
+          if (VerboseOutput)
+            std::cerr << "Vectorized guest loop at " << std::hex << Header << " (region " << EntryAddress << ")\n";
+        }
+      }
+
+      if (UseCache) {
+        RCache->insert(RegionHash, EntryAddress, *Module);
+        RegionCache::bindRelocations(*Module, 0);
+      }
 
       if (VerboseOutput)
         Module->print(llvm::errs(), nullptr);
@@ -204,9 +613,21 @@ void Manager::runPipeline() {
 
       auto Addr = IRJIT->findSymbol("r"+std::to_string(EntryAddress)).getAddress();
 
+      if (Emitted) {
+        unsigned Bucket = 1;
+        while (Bucket < OIRegion.size())
+          Bucket *= 2;
+        auto& Point = CompileTimeBySize[Bucket];
+        Point.first  += 1;
+        Point.second += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - CompileStart).count();
+      }
+
       *PerfMapFile << std::hex << "0x" << *Addr << std::dec <<" " << IREmitter::getAssemblySize((const void*) *Addr) << " r" << EntryAddress << ".oi\n";
       PerfMapFile->flush();
 
+      if (Addr && IsSpeculative)
+        SpeculativeCompiled += 1;
+
       if (Addr) {
         for (auto EA : EntryAddresses) 
           if (EA < NATIVE_REGION_SIZE) {
@@ -240,8 +661,12 @@ void Manager::runPipeline() {
 
     OIRegionsMtx.lock();
     OIRegions.erase(EntryAddress);
-    NumOfOIRegions -= 1;
-    OIRegionsKey.erase(OIRegionsKey.begin());
+    if (IsSpeculative) {
+      SpeculativeBusy = false;
+    } else {
+      NumOfOIRegions -= 1;
+      OIRegionsKey.erase(OIRegionsKey.begin());
+    }
     OIRegionsMtx.unlock();
 
     if (IsToDoWholeCompilation) {
@@ -253,7 +678,50 @@ void Manager::runPipeline() {
   isFinished = true;
 }
 
+// The candidate replaces the region in NativeRegions; the code it replaces stays in the JIT, as native
+// regions may still call it directly
+void Manager::compileTuningCandidate(Autotuner::Job Job) {
+  CompiledOIRegionsMtx.lock_shared();
+  auto It = CompiledOIRegions.find(Job.Entry);
+  OIInstList OIRegion = It == CompiledOIRegions.end() ? OIInstList() : It->second;
+  CompiledOIRegionsMtx.unlock_shared();
+
+  if (OIRegion.empty() || !isNativeRegionEntry(Job.Entry)) {
+    Tuner->finishJob();
+    return;
+  }
+
+  auto Module = llvm::make_unique<llvm::Module>(std::to_string(++ModuleId), TheContext);
+  IRE->setRelocatable(false);
+  IRE->generateRegionIR({Job.Entry}, OIRegion, DataMemOffset, TheMachine, IRJIT->getTargetMachine(),
+                      NativeRegions, Module.get());
+  IRO->optimizeModule(Module.get(), {Job.Entry});
+  IRO->customOptimizeIRFunction(Module.get(), Tuner->getPasses(Job));
+
+  NativeRegionsMtx.lock();
+  auto Key = IRJIT->addModule(std::move(Module));
+  auto Addr = IRJIT->findSymbolIn(Key, "r"+std::to_string(Job.Entry)).getAddress();
+  if (Addr) {
+    NativeRegions[Job.Entry] = static_cast<intptr_t>(*Addr);
+    *PerfMapFile << std::hex << "0x" << *Addr << std::dec << " " << IREmitter::getAssemblySize((const void*) *Addr)
+      << " r" << Job.Entry << ".oi\n";
+    PerfMapFile->flush();
+    Tuner->setInstalled(Job.Entry, Job.Candidate);
+  }
+  NativeRegionsMtx.unlock();
+
+  Tuner->finishJob();
+}
+
 bool Manager::addOIRegion(uint32_t EntryAddress, OIInstList OIRegion) {
+  if (IsSimulation) {
+    if (isRegionEntry(EntryAddress))
+      return false;
+    CompiledOIRegions[EntryAddress] = OIRegion;
+    NativeRegions[EntryAddress] = 1;
+    return true;
+  }
+
   if (!isRegionEntry(EntryAddress) && OIRegions.count(EntryAddress) == 0) {
     OIRegionsMtx.lock();
     OIRegionsKey.push_back(EntryAddress);
@@ -261,17 +729,78 @@ bool Manager::addOIRegion(uint32_t EntryAddress, OIInstList OIRegion) {
     OIRegionsMtx.unlock();
     NumOfOIRegions += 1;
     cv.notify_all();
+
+    if (Profile)
+      Profile->addRegion(EntryAddress, OIRegion);
     return true;
   }
   return false;
 }
 
+void Manager::setPreinstalledRegions(std::unordered_map<uint32_t, uint64_t> Regions) {
+  NativeRegionsMtx.lock();
+  for (auto& R : PreinstalledRegions)
+    NativeRegions[R.first] = 0;
+  PreinstalledRegions.clear();
+
+  for (auto& R : Regions) {
+    if (R.first < NATIVE_REGION_SIZE) {
+      NativeRegions[R.first] = R.second;
+      PreinstalledRegions[R.first] = R.second;
+    }
+  }
+  NativeRegionsMtx.unlock();
+}
+
+void Manager::addSpeculativeRegions(std::vector<std::pair<uint32_t, OIInstList>> Regions) {
+  SpeculativeMtx.lock();
+  for (auto& R : Regions)
+    SpeculativeRegions.push_back(R);
+  SpeculativeQueued += Regions.size();
+  NumOfSpeculative += Regions.size();
+  SpeculativeMtx.unlock();
+  cv.notify_all();
+}
+
+// Entries already formed (or compiled) by the RFT are dropped. The taken region is kept in OIRegions while
+// it compiles so the RFTs don't record it again.
+bool Manager::takeSpeculativeRegion(uint32_t& EntryAddress, OIInstList& OIRegion) {
+  std::lock_guard<std::mutex> Lock(SpeculativeMtx);
+  if (SpeculativeRegions.empty())
+    return false;
+
+  EntryAddress = SpeculativeRegions.front().first;
+  OIRegion     = SpeculativeRegions.front().second;
+  SpeculativeRegions.pop_front();
+  NumOfSpeculative -= 1;
+
+  std::unique_lock<std::shared_mutex> RegionsLock(OIRegionsMtx);
+  if (NativeRegions[EntryAddress] != 0 || OIRegions.count(EntryAddress) != 0)
+    return false;
+
+  OIRegions[EntryAddress] = OIRegion;
+  SpeculativeBusy = true;
+  return true;
+}
+
 int32_t Manager::jumpToRegion(uint32_t EntryAddress) {
+  // The trace being simulated already says where the region leaves to
+  if (IsSimulation)
+    return EntryAddress;
+
   uint32_t JumpTo  = EntryAddress;
   int32_t* RegPtr  = TheMachine.getRegisterPtr();
   uint32_t* MemPtr = TheMachine.getMemoryPtr();
 
   while (isNativeRegionEntry(JumpTo)) {
+    if (Tuner && Tuner->isSampling()) {
+      uint32_t Region = JumpTo;
+      uint64_t Start = __rdtsc();
+      JumpTo = ((uint32_t (*)(int32_t*, uint32_t*, uint32_t)) NativeRegions[JumpTo])(RegPtr, MemPtr, EntryAddress);
+      if (Tuner->addSample(Region, __rdtsc() - Start))
+        cv.notify_all();
+      continue;
+    }
     JumpTo = ((uint32_t (*)(int32_t*, uint32_t*, uint32_t)) NativeRegions[JumpTo])(RegPtr, MemPtr, EntryAddress);
   }
 
@@ -281,6 +810,17 @@ int32_t Manager::jumpToRegion(uint32_t EntryAddress) {
 void Manager::reset() {  
     while (NumOfOIRegions != 0); 
 
+    SpeculativeMtx.lock();
+    SpeculativeRegions.clear();
+    NumOfSpeculative = 0;
+    SpeculativeMtx.unlock();
+    while (SpeculativeBusy);
+
+    if (Tuner) {
+      Tuner->reset();
+      while (Tuner->isBusy());
+    }
+
     OIRegionsKey.clear();
     OIRegions.clear();
     CompiledOIRegions.clear();
@@ -291,4 +831,6 @@ void Manager::reset() {
     IRRegions.clear();
     for (unsigned I = 0; I < NATIVE_REGION_SIZE; I++)
        NativeRegions[I] = 0; 
+    for (auto& R : PreinstalledRegions)
+       NativeRegions[R.first] = R.second;
 }
@@ -0,0 +1,230 @@
+#include <pipelineModel.hpp>
+#include <IROpt.hpp>
+#include <OIDecoder.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <unistd.h>
+
+using namespace dbt;
+
+#define MODEL_VERSION 1
+
+PipelineModel::Features PipelineModel::getFeatures(const OIInstList& OIRegion) {
+  Features F;
+  F.fill(0);
+
+  std::set<uint32_t> Addrs;
+  for (auto Pair : OIRegion)
+    Addrs.insert(Pair[0]);
+
+  for (auto Pair : OIRegion) {
+    OIDecoder::OIInst I = OIDecoder::decode(Pair[1]);
+    switch (I.Type) {
+      case OIDecoder::Ldw: case OIDecoder::Ldh: case OIDecoder::Ldhu: case OIDecoder::Ldb: case OIDecoder::Ldbu:
+      case OIDecoder::Ldc1: case OIDecoder::Lwc1: case OIDecoder::Ldxc1: case OIDecoder::Lwxc1:
+        F[Loads] += 1;
+        break;
+      case OIDecoder::Stw: case OIDecoder::Sth: case OIDecoder::Stb:
+      case OIDecoder::Sdc1: case OIDecoder::Swc1: case OIDecoder::Sdxc1: case OIDecoder::Swxc1:
+        F[Stores] += 1;
+        break;
+      case OIDecoder::Call: case OIDecoder::Callr:
+        F[Calls] += 1;
+        break;
+      case OIDecoder::Mul: case OIDecoder::Mulu: case OIDecoder::Div: case OIDecoder::Divu:
+      case OIDecoder::Mod: case OIDecoder::Modu:
+        F[MulDivs] += 1;
+        break;
+      case OIDecoder::Adds: case OIDecoder::Addd: case OIDecoder::Subs: case OIDecoder::Subd:
+      case OIDecoder::Muls: case OIDecoder::Muld: case OIDecoder::Divs: case OIDecoder::Divd:
+      case OIDecoder::Madds: case OIDecoder::Maddd: case OIDecoder::Msubs: case OIDecoder::Msubd:
+      case OIDecoder::Sqrts: case OIDecoder::Sqrtd: case OIDecoder::Negs: case OIDecoder::Negd:
+      case OIDecoder::Abss: case OIDecoder::Absd: case OIDecoder::Cvtsw: case OIDecoder::Cvtdw:
+      case OIDecoder::Cvtds: case OIDecoder::Cvtsd: case OIDecoder::Truncws: case OIDecoder::Truncwd:
+        F[Floats] += 1;
+        break;
+      default:
+        break;
+    }
+
+    if (OIDecoder::isIndirectBranch(I)) {
+      F[Indirects] += 1;
+    } else if (OIDecoder::isControlFlowInst(I) && I.Type != OIDecoder::Call) {
+      F[Branches] += 1;
+      uint32_t Target = OIDecoder::getPossibleTargets(Pair[0], I)[0];
+      if (Target <= Pair[0] && Addrs.count(Target) != 0)
+        F[Loops] += 1;
+    }
+  }
+
+  // The mix is relative to the size, so large and small regions of the same shape look alike
+  double N = OIRegion.empty() ? 1 : OIRegion.size();
+  for (unsigned I = 0; I < NumOfFeatures; I++)
+    if (I != Loops)
+      F[I] /= N;
+  F[Size] = std::log2(N);
+  return F;
+}
+
+// Predicted passes go straight to IROpt::customOptimizeIRFunction
+static bool isValidPipeline(const std::vector<std::string>& Passes) {
+  if (Passes.empty())
+    return false;
+  for (auto& Pass : Passes)
+    if (!IROpt::isKnownPass(Pass))
+      return false;
+  return true;
+}
+
+void PipelineModel::addSample(const OIInstList& OIRegion, const std::vector<std::string>& Passes) {
+  if (!isValidPipeline(Passes))
+    return;
+
+  unsigned Id = 0;
+  while (Id < Pipelines.size() && Pipelines[Id] != Passes)
+    Id++;
+  if (Id == Pipelines.size())
+    Pipelines.push_back(Passes);
+
+  Samples.push_back({Id, getFeatures(OIRegion)});
+}
+
+// Features are scaled by their deviation over all the samples, so none dominates the distance
+void PipelineModel::fit() {
+  Features Mean, Var;
+  Mean.fill(0);
+  Var.fill(0);
+  for (auto& S : Samples)
+    for (unsigned I = 0; I < NumOfFeatures; I++)
+      Mean[I] += S.second[I] / Samples.size();
+  for (auto& S : Samples)
+    for (unsigned I = 0; I < NumOfFeatures; I++)
+      Var[I] += (S.second[I] - Mean[I]) * (S.second[I] - Mean[I]) / Samples.size();
+  for (unsigned I = 0; I < NumOfFeatures; I++)
+    Scale[I] = Var[I] > 0 ? 1 / std::sqrt(Var[I]) : 0;
+
+  Features Zero;
+  Zero.fill(0);
+  Centroids.assign(Pipelines.size(), Zero);
+  Counts.assign(Pipelines.size(), 0);
+  for (auto& S : Samples) {
+    Counts[S.first] += 1;
+    for (unsigned I = 0; I < NumOfFeatures; I++)
+      Centroids[S.first][I] += S.second[I];
+  }
+  for (unsigned P = 0; P < Pipelines.size(); P++)
+    for (unsigned I = 0; I < NumOfFeatures; I++)
+      if (Counts[P] != 0)
+        Centroids[P][I] /= Counts[P];
+}
+
+const std::vector<std::string>* PipelineModel::predict(const OIInstList& OIRegion) const {
+  if (Samples.empty())
+    return nullptr;
+
+  Features F = getFeatures(OIRegion);
+  unsigned Best = 0;
+  double BestDist = std::numeric_limits<double>::infinity();
+  for (unsigned P = 0; P < Centroids.size(); P++) {
+    if (Counts[P] == 0)
+      continue;
+
+    double Dist = 0;
+    for (unsigned I = 0; I < NumOfFeatures; I++) {
+      double D = (F[I] - Centroids[P][I]) * Scale[I];
+      Dist += D * D;
+    }
+    if (Dist < BestDist) {
+      BestDist = Dist;
+      Best = P;
+    }
+  }
+  return &Pipelines[Best];
+}
+
+// "pipeline <passes...>" lines, then "sample <pipeline> <features...>". Pipelines that are empty or name
+// an unknown pass are dropped with their samples.
+bool PipelineModel::load(std::string Path) {
+  std::ifstream File(Path);
+  if (!File.is_open())
+    return false;
+
+  std::string Line, Kind;
+  unsigned Version = 0;
+  if (!std::getline(File, Line) || !(std::istringstream(Line) >> Kind >> Version) || Kind != "oi-model" ||
+      Version != MODEL_VERSION) {
+    std::cerr << "Ignoring the pipeline model " << Path << " (unknown format)\n";
+    return false;
+  }
+
+  // Pipeline id in the file -> index in Pipelines (-1 when dropped)
+  std::vector<int> Ids;
+  unsigned Dropped = 0;
+  while (std::getline(File, Line)) {
+    std::istringstream ISS(Line);
+    if (!(ISS >> Kind))
+      continue;
+
+    if (Kind == "pipeline") {
+      std::vector<std::string> Passes;
+      std::string Pass;
+      while (ISS >> Pass)
+        Passes.push_back(Pass);
+      if (isValidPipeline(Passes)) {
+        Ids.push_back(Pipelines.size());
+        Pipelines.push_back(Passes);
+      } else {
+        Ids.push_back(-1);
+        Dropped += 1;
+      }
+    } else if (Kind == "sample") {
+      unsigned Id;
+      Features F;
+      if (!(ISS >> Id) || Id >= Ids.size() || Ids[Id] < 0)
+        continue;
+      for (auto& V : F)
+        ISS >> V;
+      if (ISS)
+        Samples.push_back({(unsigned) Ids[Id], F});
+    }
+  }
+
+  if (Dropped != 0)
+    std::cerr << "Pipeline model " << Path << ": " << Dropped << " invalid pipelines dropped\n";
+
+  fit();
+  return true;
+}
+
+bool PipelineModel::write(std::string Path) {
+  std::string TmpPath = Path + "." + std::to_string(getpid());
+  std::ofstream File(TmpPath);
+  if (!File.is_open()) {
+    std::cerr << "Can't write the pipeline model " << TmpPath << "\n";
+    return false;
+  }
+
+  File << "oi-model " << MODEL_VERSION << "\n";
+  for (auto& P : Pipelines) {
+    File << "pipeline";
+    for (auto& Pass : P)
+      File << " " << Pass;
+    File << "\n";
+  }
+
+  File.precision(17);
+  for (auto& S : Samples) {
+    File << "sample " << S.first;
+    for (auto V : S.second)
+      File << " " << V;
+    File << "\n";
+  }
+  File.close();
+  return std::rename(TmpPath.c_str(), Path.c_str()) == 0;
+}
@@ -0,0 +1,127 @@
+#include <profileDB.hpp>
+#include <aot.hpp>
+#include <machine.hpp>
+
+#include "llvm/Support/FileSystem.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace dbt;
+
+#define PROFILE_VERSION 1
+
+ProfileDB::ProfileDB(std::string Dir, Machine& M) : BinaryHash(AOTCompiler::hashBinary(M)) {
+  if (Dir.back() != '/')
+    Dir += '/';
+  llvm::sys::fs::create_directories(Dir);
+
+  std::ostringstream Name;
+  Name << Dir << std::hex << BinaryHash << ".prof";
+  Path = Name.str();
+
+  if (!load())
+    Runs = 0;
+}
+
+// Text lines: a header, then "b <target> <count>", "i <source> <target> <count>" and "r <entry> <n>"
+// followed by the n "<addrs> <word>" of the region
+bool ProfileDB::load() {
+  std::ifstream File(Path);
+  if (!File.is_open())
+    return false;
+
+  std::string Magic;
+  unsigned Version;
+  uint64_t Hash;
+  if (!(File >> Magic >> Version >> std::hex >> Hash >> std::dec >> Runs) || Magic != "oi-profile" ||
+      Version != PROFILE_VERSION || Hash != BinaryHash) {
+    std::cerr << "Ignoring the profile " << Path << " (other binary or version)\n";
+    BranchFreq.clear();
+    IndirectTargets.clear();
+    Regions.clear();
+    return false;
+  }
+
+  std::string Kind;
+  while (File >> Kind) {
+    uint32_t Addrs, Target;
+    uint64_t Count;
+    if (Kind == "b" && File >> Addrs >> Count) {
+      BranchFreq[Addrs] += Count;
+    } else if (Kind == "i" && File >> Addrs >> Target >> Count) {
+      IndirectTargets[Addrs][Target] += Count;
+    } else if (Kind == "r" && File >> Addrs >> Count) {
+      OIInstList Insts(Count);
+      for (auto& I : Insts)
+        File >> I[0] >> I[1];
+      Regions[Addrs] = Insts;
+    } else {
+      break;
+    }
+  }
+  return true;
+}
+
+void ProfileDB::addRegion(uint32_t Entry, const OIInstList& Insts) {
+  std::lock_guard<std::mutex> Lock(RegionsMtx);
+  Regions[Entry] = Insts;
+}
+
+std::vector<std::pair<uint32_t, OIInstList>> ProfileDB::getHotRegions() {
+  std::lock_guard<std::mutex> Lock(RegionsMtx);
+  std::vector<std::pair<uint32_t, OIInstList>> Hot(Regions.begin(), Regions.end());
+
+  auto getFreq = [this](uint32_t Entry) {
+    auto It = BranchFreq.find(Entry);
+    return It == BranchFreq.end() ? 0 : It->second;
+  };
+  std::stable_sort(Hot.begin(), Hot.end(), [&](const auto& A, const auto& B) {
+      return getFreq(A.first) > getFreq(B.first);
+    });
+  return Hot;
+}
+
+std::map<uint32_t, uint64_t> ProfileDB::getIndirectTargets(uint32_t Source) {
+  auto It = IndirectTargets.find(Source);
+  return It == IndirectTargets.end() ? std::map<uint32_t, uint64_t>() : It->second;
+}
+
+bool ProfileDB::write() {
+  std::string TmpPath = Path + "." + std::to_string(getpid());
+  std::ofstream File(TmpPath);
+  if (!File.is_open()) {
+    std::cerr << "Can't write the profile " << TmpPath << "\n";
+    return false;
+  }
+
+  File << "oi-profile " << PROFILE_VERSION << " " << std::hex << BinaryHash << std::dec << " " << Runs + 1 << "\n";
+
+  std::map<uint32_t, uint64_t> Branches(BranchFreq.begin(), BranchFreq.end());
+  for (auto& B : Branches)
+    File << "b " << B.first << " " << B.second << "\n";
+
+  std::map<uint32_t, std::map<uint32_t, uint64_t>> Indirects(IndirectTargets.begin(), IndirectTargets.end());
+  for (auto& I : Indirects)
+    for (auto& T : I.second)
+      File << "i " << I.first << " " << T.first << " " << T.second << "\n";
+
+  RegionsMtx.lock();
+  for (auto& R : Regions) {
+    File << "r " << R.first << " " << R.second.size() << "\n";
+    for (auto& I : R.second)
+      File << I[0] << " " << I[1] << "\n";
+  }
+  RegionsMtx.unlock();
+
+  File.close();
+  if (!File || std::rename(TmpPath.c_str(), Path.c_str()) != 0) {
+    std::cerr << "Can't write the profile " << Path << "\n";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,150 @@
+#include <regionArchive.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace dbt;
+
+#define REGION_ARCHIVE_MAGIC 0x41524f49 /* OIRA */
+#define REGION_ARCHIVE_VERSION 1
+
+struct RegionArchiveHeader {
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t NumRecords;
+  uint32_t Reserved;
+};
+
+void RegionArchiveWriter::add(uint32_t Entry, const OIInstList& Insts, std::string Bitcode, std::vector<std::string> Opts) {
+  std::string OptsList;
+  for (auto& O : Opts)
+    OptsList += (OptsList.empty() ? "" : " ") + O;
+  Regions.push_back({Entry, Insts, Bitcode, OptsList});
+}
+
+bool RegionArchiveWriter::write(std::string Path) {
+  std::string TmpPath = Path + "." + std::to_string(getpid());
+  std::ofstream OS(TmpPath, std::ios::binary);
+  if (!OS) {
+    std::cerr << "Can't write the region archive " << TmpPath << "\n";
+    return false;
+  }
+
+  RegionArchiveHeader Header = {REGION_ARCHIVE_MAGIC, REGION_ARCHIVE_VERSION, (uint32_t) Regions.size(), 0};
+  std::vector<RegionArchiveRecord> Records(Regions.size());
+
+  // Blobs are laid out after the index, instruction arrays first so they stay 4 byte aligned
+  uint64_t Offset = sizeof(Header) + Records.size() * sizeof(RegionArchiveRecord);
+  for (size_t I = 0; I < Regions.size(); I++) {
+    Records[I] = {Regions[I].Entry, (uint32_t) Regions[I].Insts.size(), Offset, 0, Regions[I].Bitcode.size(), 0,
+                  (uint32_t) Regions[I].Opts.size(), (uint32_t) I};
+    Offset += Regions[I].Insts.size() * sizeof(uint32_t) * 2;
+  }
+  for (size_t I = 0; I < Regions.size(); I++) {
+    Records[I].BitcodeOffset = Offset;
+    Offset += Regions[I].Bitcode.size();
+  }
+  for (size_t I = 0; I < Regions.size(); I++) {
+    Records[I].OptsOffset = Offset;
+    Offset += Regions[I].Opts.size();
+  }
+
+  OS.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+  OS.write(reinterpret_cast<const char*>(Records.data()), Records.size() * sizeof(RegionArchiveRecord));
+  for (auto& R : Regions)
+    OS.write(reinterpret_cast<const char*>(R.Insts.data()), R.Insts.size() * sizeof(uint32_t) * 2);
+  for (auto& R : Regions)
+    OS << R.Bitcode;
+  for (auto& R : Regions)
+    OS << R.Opts;
+  OS.close();
+
+  return std::rename(TmpPath.c_str(), Path.c_str()) == 0;
+}
+
+RegionArchive::RegionArchive(std::string Path) {
+  int FD = open(Path.c_str(), O_RDONLY);
+  if (FD < 0) {
+    std::cerr << "Can't open the region archive " << Path << "\n";
+    return;
+  }
+
+  struct stat St;
+  if (fstat(FD, &St) == 0 && St.st_size >= (off_t) sizeof(RegionArchiveHeader)) {
+    void* Map = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, FD, 0);
+    if (Map != MAP_FAILED) {
+      Data = static_cast<const char*>(Map);
+      Size = St.st_size;
+    }
+  }
+  close(FD);
+
+  if (Data == nullptr)
+    return;
+
+  auto Header = reinterpret_cast<const RegionArchiveHeader*>(Data);
+  if (Header->Magic != REGION_ARCHIVE_MAGIC || Header->Version != REGION_ARCHIVE_VERSION ||
+      sizeof(RegionArchiveHeader) + (uint64_t) Header->NumRecords * sizeof(RegionArchiveRecord) > Size) {
+    std::cerr << Path << " is not a region archive\n";
+    return;
+  }
+
+  auto First = reinterpret_cast<const RegionArchiveRecord*>(Data + sizeof(RegionArchiveHeader));
+  for (uint32_t I = 0; I < Header->NumRecords; I++) {
+    const RegionArchiveRecord& R = First[I];
+    if (R.InstsOffset + (uint64_t) R.NumInsts * sizeof(uint32_t) * 2 > Size || R.BitcodeOffset + R.BitcodeSize > Size ||
+        R.OptsOffset + R.OptsSize > Size) {
+      std::cerr << Path << " is truncated\n";
+      Index.clear();
+      return;
+    }
+    Index[R.Entry] = I;
+  }
+
+  NumRecords = Header->NumRecords;
+  Records = First;
+}
+
+RegionArchive::~RegionArchive() {
+  if (Data != nullptr)
+    munmap(const_cast<char*>(Data), Size);
+}
+
+std::vector<uint32_t> RegionArchive::getEntries() {
+  std::vector<uint32_t> Entries(NumRecords);
+  for (uint32_t I = 0; I < NumRecords; I++)
+    Entries[Records[I].Hotness < NumRecords ? Records[I].Hotness : I] = Records[I].Entry;
+  return Entries;
+}
+
+OIInstList RegionArchive::getRegion(uint32_t Entry) {
+  const RegionArchiveRecord& R = Records[Index[Entry]];
+  auto Words = reinterpret_cast<const uint32_t*>(Data + R.InstsOffset);
+
+  OIInstList Insts(R.NumInsts);
+  for (uint32_t I = 0; I < R.NumInsts; I++)
+    Insts[I] = {Words[2*I], Words[2*I + 1]};
+  return Insts;
+}
+
+llvm::StringRef RegionArchive::getBitcode(uint32_t Entry) {
+  const RegionArchiveRecord& R = Records[Index[Entry]];
+  return llvm::StringRef(Data + R.BitcodeOffset, R.BitcodeSize);
+}
+
+std::vector<std::string> RegionArchive::getOpts(uint32_t Entry) {
+  const RegionArchiveRecord& R = Records[Index[Entry]];
+  std::istringstream ISS(std::string(Data + R.OptsOffset, R.OptsSize));
+  std::vector<std::string> Opts;
+  std::string Opt;
+  while (ISS >> Opt)
+    Opts.push_back(Opt);
+  return Opts;
+}
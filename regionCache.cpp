@@ -0,0 +1,224 @@
+#include <regionCache.hpp>
+#include <OIDecoder.hpp>
+#include <machine.hpp>
+
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace dbt;
+
+// Bumped whenever the emitted IR of a region changes shape
+#define REGION_CACHE_VERSION 3
+
+RegionCache::RegionCache(std::string Path) : CachePath(Path) {
+  if (!CachePath.empty()) {
+    if (CachePath.back() != '/')
+      CachePath += '/';
+    llvm::sys::fs::create_directories(CachePath);
+  }
+}
+
+// FNV-1a
+uint64_t RegionCache::hashBytes(const void* Data, size_t Size, uint64_t Seed) {
+  const uint8_t* Bytes = static_cast<const uint8_t*>(Data);
+  uint64_t Hash = Seed;
+  for (size_t I = 0; I < Size; I++) {
+    Hash ^= Bytes[I];
+    Hash *= 0x100000001b3ULL;
+  }
+  return Hash;
+}
+
+uint64_t RegionCache::hashConfig(const std::vector<uint32_t>& Config) {
+  uint32_t Version = REGION_CACHE_VERSION;
+  uint64_t Hash = hashBytes(&Version, sizeof(Version));
+  return hashBytes(Config.data(), Config.size() * sizeof(uint32_t), Hash);
+}
+
+uint64_t RegionCache::hashRegion(uint32_t Entry, const OIInstList& OIRegion, uint32_t DataMemOffset, dbt::Machine& M,
+                                 uint64_t Config) {
+  OIInstList Sorted = OIRegion;
+  std::sort(Sorted.begin(), Sorted.end(), [](const auto& lhs, const auto& rhs) { return lhs[0] < rhs[0]; });
+
+  uint64_t Hash = hashBytes(&DataMemOffset, sizeof(DataMemOffset), Config);
+  for (auto Pair : Sorted) {
+    OIDecoder::OIInst Inst = OIDecoder::decode(Pair[1]);
+
+    // Words are position independent except for absolute jump/call targets, which are hashed relative to the entry
+    std::array<uint32_t, 5> Key = {Pair[0] - Entry, Pair[1], 0, 0, 0};
+    if (Inst.Type == OIDecoder::Jump || Inst.Type == OIDecoder::Call) {
+      Key[1] = Inst.Type;
+      Key[2] = 1;
+      Key[3] = OIDecoder::getPossibleTargets(Pair[0], Inst)[0] - Entry;
+      if (M.getIntrinsic(Key[3] + Entry) != nullptr)
+        Key[2] = 2;
+    }
+
+    // Method boundaries shape how the region is split in LLVM functions
+    if (M.isMethodEntry(Pair[0]))
+      Key[4] = M.getMethodEnd(Pair[0]) - Entry;
+
+    Hash = hashBytes(Key.data(), sizeof(Key), Hash);
+  }
+  return Hash;
+}
+
+void RegionCache::bindRelocations(llvm::Module& M, int32_t Delta) {
+  if (Delta != 0) {
+    std::vector<std::pair<llvm::Function*, uint32_t>> Renamed;
+    for (auto& F : M) {
+      uint32_t Addrs;
+      llvm::StringRef Name = F.getName();
+      if (Name.startswith("r") && !Name.drop_front(1).getAsInteger(10, Addrs))
+        Renamed.push_back({&F, Addrs + Delta});
+    }
+
+    // Two steps so a function is never renamed to a name that is still taken
+    for (auto& P : Renamed)
+      P.first->setName("oi.reloc." + std::to_string(P.second));
+    for (auto& P : Renamed)
+      P.first->setName("r" + std::to_string(P.second));
+  }
+
+  llvm::GlobalVariable* Reloc = M.getNamedGlobal("oi.reloc");
+  if (Reloc == nullptr)
+    return;
+
+  llvm::Constant* Const = llvm::ConstantInt::get(Reloc->getValueType(), Delta);
+  llvm::SetVector<llvm::Instruction*> Worklist;
+
+  std::vector<llvm::User*> Users(Reloc->user_begin(), Reloc->user_end());
+  for (auto U : Users) {
+    if (auto LI = llvm::dyn_cast<llvm::LoadInst>(U)) {
+      for (auto LU : LI->users())
+        Worklist.insert(llvm::cast<llvm::Instruction>(LU));
+      LI->replaceAllUsesWith(Const);
+      LI->eraseFromParent();
+    }
+  }
+
+  const llvm::DataLayout& DL = M.getDataLayout();
+  while (!Worklist.empty()) {
+    llvm::Instruction* I = Worklist.pop_back_val();
+    if (llvm::Constant* C = llvm::ConstantFoldInstruction(I, DL)) {
+      for (auto IU : I->users())
+        Worklist.insert(llvm::cast<llvm::Instruction>(IU));
+      I->replaceAllUsesWith(C);
+      I->eraseFromParent();
+    }
+  }
+
+  // Regions that call into the syscall manager touch host state besides their arguments
+  llvm::Function* Syscall = M.getFunction("dbt_region_syscall");
+
+  if (Reloc->use_empty()) {
+    Reloc->eraseFromParent();
+    for (auto& F : M) {
+      bool CallsSyscall = false;
+      if (Syscall != nullptr)
+        for (auto U : Syscall->users())
+          if (auto CI = llvm::dyn_cast<llvm::CallInst>(U))
+            CallsSyscall |= CI->getFunction() == &F;
+
+      if (!F.isDeclaration() && F.getName().startswith("r") && !CallsSyscall)
+        F.addFnAttr(llvm::Attribute::ArgMemOnly);
+    }
+  }
+}
+
+std::string RegionCache::getRegionPath(uint64_t Hash) {
+  std::ostringstream Name;
+  Name << CachePath << std::hex << Hash << ".bc";
+  return Name.str();
+}
+
+bool RegionCache::loadFromDisk(uint64_t Hash) {
+  if (CachePath.empty())
+    return false;
+
+  auto Buffer = llvm::MemoryBuffer::getFile(getRegionPath(Hash));
+  if (!Buffer)
+    return false;
+
+  Regions[Hash] = (*Buffer)->getBuffer().str();
+  DiskHits += 1;
+  return true;
+}
+
+llvm::Module* RegionCache::lookup(uint64_t Hash, uint32_t Entry, llvm::LLVMContext& C) {
+  std::lock_guard<std::mutex> Lock(CacheMtx);
+
+  if (Regions.count(Hash) == 0 && !loadFromDisk(Hash)) {
+    Misses += 1;
+    return nullptr;
+  }
+
+  auto Buffer = llvm::MemoryBuffer::getMemBuffer(Regions[Hash], "", false);
+  auto M = llvm::parseBitcodeFile(Buffer->getMemBufferRef(), C);
+  if (!M) {
+    llvm::consumeError(M.takeError());
+    Misses += 1;
+    return nullptr;
+  }
+
+  auto CachedEntry = llvm::mdconst::extract_or_null<llvm::ConstantInt>((*M)->getModuleFlag("oi.entry"));
+  if (CachedEntry == nullptr) {
+    Misses += 1;
+    return nullptr;
+  }
+
+  int32_t Delta = Entry - static_cast<uint32_t>(CachedEntry->getZExtValue());
+  bindRelocations(**M, Delta);
+
+  if ((*M)->getFunction("r" + std::to_string(Entry)) == nullptr) {
+    Misses += 1;
+    return nullptr;
+  }
+
+  if (Delta != 0)
+    Relocated += 1;
+  Hits += 1;
+  return M->release();
+}
+
+void RegionCache::insert(uint64_t Hash, uint32_t Entry, llvm::Module& M) {
+  if (M.getModuleFlag("oi.entry") == nullptr)
+    M.addModuleFlag(llvm::Module::Warning, "oi.entry", Entry);
+
+  std::string Bitcode;
+  llvm::raw_string_ostream OS(Bitcode);
+  llvm::WriteBitcodeToFile(M, OS);
+  OS.flush();
+
+  std::lock_guard<std::mutex> Lock(CacheMtx);
+  Regions[Hash] = Bitcode;
+
+  if (CachePath.empty())
+    return;
+
+  // Write and rename so concurrent runs sharing the directory never see a partial file
+  std::string Path = getRegionPath(Hash);
+  std::string TmpPath = Path + "." + std::to_string(getpid());
+  std::error_code EC;
+  llvm::raw_fd_ostream File(TmpPath, EC, llvm::sys::fs::F_None);
+  if (EC) {
+    std::cerr << "Can't write region cache file " << TmpPath << "\n";
+    return;
+  }
+  File << Bitcode;
+  File.close();
+  std::rename(TmpPath.c_str(), Path.c_str());
+}
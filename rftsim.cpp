@@ -0,0 +1,150 @@
+#include <arglib/arglib.hpp>
+#include <branchTrace.hpp>
+#include <RFT.hpp>
+#include <manager.hpp>
+#include <machine.hpp>
+#include <timer.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <unordered_set>
+
+// Replays a branch trace recorded with `oi-dbt -btrace` through the RFTs, without emulating the binary
+
+clarg::argString BinaryFlag("-bin", "Path to the binary the trace was recorded from", "");
+clarg::argString TraceFlag("-trace", "Branch trace file", "");
+clarg::argString RFTFlag("-rft", "Comma separated RFTs to simulate", "netplus-e-r");
+clarg::argString HotnessFlag("-hot", "Comma separated hotness thresholds to simulate", "50");
+clarg::argBool   HelpFlag("-h", "display the help message");
+
+dbt::Machine M;
+
+static std::vector<std::string> split(std::string List) {
+  std::vector<std::string> Items;
+  std::istringstream ISS(List);
+  std::string Item;
+  while (std::getline(ISS, Item, ','))
+    if (!Item.empty())
+      Items.push_back(Item);
+  return Items;
+}
+
+struct SimulationReport {
+  uint64_t Events = 0, TotalInsts = 0, NativeInsts = 0;
+  uint64_t RegionEntries = 0, CompletedEntries = 0;
+  uint64_t Regions = 0, StaticInsts = 0, UniqueInsts = 0;
+};
+
+// A region execution is complete when it gets back to its entry or leaves from its last recorded
+// instruction, i.e. it did not side exit in the middle of the recorded path
+static SimulationReport simulate(dbt::RFT& R, dbt::Manager& TheManager, std::string TracePath) {
+  SimulationReport Report;
+  dbt::BranchTraceReader Trace(TracePath);
+
+  std::unordered_map<uint32_t, std::pair<std::unordered_set<uint32_t>, uint32_t>> RegionAddrs;
+  std::pair<std::unordered_set<uint32_t>, uint32_t>* Current = nullptr;
+  uint32_t CurrentEntry = 0;
+  bool Completed = false;
+
+  uint32_t Source, Target, LastTarget = 0;
+  while (Trace.next(Source, Target)) {
+    if (Report.Events++ != 0) {
+      uint64_t Executed = Source >= LastTarget ? (Source - LastTarget) / 4 + 1 : 1;
+      Report.TotalInsts += Executed;
+      if (Current != nullptr)
+        Report.NativeInsts += Executed;
+    }
+    LastTarget = Target;
+
+    if (Current != nullptr) {
+      Completed |= Target == CurrentEntry || Source == Current->second;
+      if (Current->first.count(Target) != 0)
+        continue;
+
+      Report.CompletedEntries += Completed;
+      Current = nullptr;
+    }
+
+    M.setPC(Source);
+    M.setPC(Target);
+    R.onBranch(M);
+
+    if (TheManager.isNativeRegionEntry(Target)) {
+      if (RegionAddrs.count(Target) == 0) {
+        auto& Entry = RegionAddrs[Target];
+        for (auto Inst : TheManager.getCompiledOIRegion(Target))
+          Entry.first.insert(Inst[0]);
+        Entry.second = TheManager.getCompiledOIRegion(Target).back()[0];
+      }
+      Current = &RegionAddrs[Target];
+      CurrentEntry = Target;
+      Completed = false;
+      Report.RegionEntries += 1;
+    }
+  }
+
+  std::unordered_set<uint32_t> Unique;
+  for (auto Region = TheManager.oiregions_begin(); Region != TheManager.oiregions_end(); ++Region) {
+    Report.Regions += 1;
+    Report.StaticInsts += Region->second.size();
+    for (auto Inst : Region->second)
+      Unique.insert(Inst[0]);
+  }
+  Report.UniqueInsts = Unique.size();
+  return Report;
+}
+
+int main(int argc, char** argv) {
+  if (clarg::parse_arguments(argc, argv)) {
+    std::cerr << "Error when parsing the arguments!" << std::endl;
+    return 1;
+  }
+
+  if (HelpFlag.get_value() || !BinaryFlag.was_set() || !TraceFlag.was_set()) {
+    std::cout << "Usage: " << argv[0] << " -bin PathToBinary -trace PathToTrace [-rft net,mret2,...] [-hot 50,100,...]\n\n";
+    clarg::arguments_descriptions(std::cout, "  ", "\n");
+    return 1;
+  }
+
+  if (!M.loadELF(BinaryFlag.get_value())) {
+    std::cerr << "Can't find or process ELF file " << BinaryFlag.get_value() << std::endl;
+    return 2;
+  }
+
+  if (!dbt::BranchTraceReader(TraceFlag.get_value()).isOpen()) {
+    std::cerr << "Can't read the branch trace " << TraceFlag.get_value() << std::endl;
+    return 2;
+  }
+
+  dbt::Manager TheManager(M);
+  TheManager.setSimulation(true);
+
+  std::cout << "rft\thot\tregions\tstatic\tdup\tcoverage\tcompletion\tevents\ttime(s)\n";
+  for (auto RFTName : split(RFTFlag.get_value())) {
+    for (auto Hot : split(HotnessFlag.get_value())) {
+      auto R = dbt::RFT::create(RFTName, TheManager);
+      if (!R) {
+        std::cerr << "Unknown RFT " << RFTName << "\n";
+        return 1;
+      }
+      R->setHotnessThreshold(std::stoi(Hot));
+
+      dbt::Timer T;
+      T.startClock();
+      SimulationReport Report = simulate(*R, TheManager, TraceFlag.get_value());
+      T.stopClock();
+
+      std::cout << std::fixed << std::setprecision(3) << RFTName << "\t" << Hot << "\t" << Report.Regions << "\t"
+        << Report.StaticInsts << "\t" << (Report.UniqueInsts ? (double) Report.StaticInsts / Report.UniqueInsts : 0) << "\t"
+        << (Report.TotalInsts ? (double) Report.NativeInsts / Report.TotalInsts : 0) << "\t"
+        << (Report.RegionEntries ? (double) Report.CompletedEntries / Report.RegionEntries : 0) << "\t"
+        << Report.Events << "\t" << T.getTime() << "\n";
+
+      TheManager.reset();
+    }
+  }
+
+  return 0;
+}
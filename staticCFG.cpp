@@ -0,0 +1,140 @@
+#include <staticCFG.hpp>
+#include <OIDecoder.hpp>
+
+#include <algorithm>
+#include <tuple>
+
+using namespace dbt;
+
+StaticCFG::StaticCFG(Machine& M) : TheMachine(M) {
+  MethodEntries = M.getVectorOfMethodEntries();
+  std::sort(MethodEntries.begin(), MethodEntries.end());
+
+  std::vector<std::pair<uint32_t, uint32_t>> Calls;
+  for (uint32_t Addrs = M.getCodeStartAddrs(); Addrs < M.getCodeEndAddrs(); Addrs += 4) {
+    OIDecoder::OIInst I = OIDecoder::decode(M.getInstAt(Addrs).asI_);
+    if (!OIDecoder::isControlFlowInst(I) || OIDecoder::isIndirectBranch(I))
+      continue;
+
+    uint32_t Target = OIDecoder::getPossibleTargets(Addrs, I)[0];
+    uint32_t From = getMethod(Addrs), To = getMethod(Target);
+    if (From != To && To != 0)
+      Callees[From].insert(To);
+
+    if (I.Type == OIDecoder::Call)
+      Calls.push_back({Addrs, Target});
+    else if (Target <= Addrs && From == To)
+      Loops.push_back({Target, Addrs, 0});
+  }
+
+  // Loops sharing a header are the same loop with several latches
+  std::sort(Loops.begin(), Loops.end(), [](const Loop& A, const Loop& B) {
+      return A.Header < B.Header || (A.Header == B.Header && A.Latch > B.Latch); });
+  Loops.erase(std::unique(Loops.begin(), Loops.end(), [](const Loop& A, const Loop& B) {
+      return A.Header == B.Header; }), Loops.end());
+
+  for (auto& L : Loops)
+    for (auto& K : Loops)
+      if (K.Header <= L.Header && L.Latch <= K.Latch)
+        L.Depth += 1;
+
+  for (auto& C : Calls) {
+    unsigned Depth = 0;
+    for (auto& L : Loops)
+      if (L.Header <= C.first && C.first <= L.Latch)
+        Depth = std::max(Depth, L.Depth);
+    if (Depth != 0 && TheMachine.isMethodEntry(C.second))
+      CalledFromLoops[C.second] = std::max(CalledFromLoops[C.second], Depth);
+  }
+}
+
+uint32_t StaticCFG::getMethod(uint32_t Addrs) {
+  auto It = std::upper_bound(MethodEntries.begin(), MethodEntries.end(), Addrs);
+  return It == MethodEntries.begin() ? 0 : *(It - 1);
+}
+
+uint32_t StaticCFG::getMethodEnd(uint32_t Entry) {
+  auto It = std::upper_bound(MethodEntries.begin(), MethodEntries.end(), Entry);
+  return It == MethodEntries.end() ? TheMachine.getCodeEndAddrs() : std::min(*It, TheMachine.getCodeEndAddrs());
+}
+
+bool StaticCFG::isAllowedToStart(uint32_t Addrs) {
+  auto Type = OIDecoder::decode(TheMachine.getInstAt(Addrs).asI_).Type;
+  return !(Type == OIDecoder::Syscall || Type == OIDecoder::Ijmp || Type == OIDecoder::Callr);
+}
+
+OIInstList StaticCFG::getRegion(uint32_t Entry, uint32_t End) {
+  OIInstList Region;
+  for (uint32_t Addrs = Entry; Addrs < End; Addrs += 4)
+    Region.push_back({Addrs, TheMachine.getInstAt(Addrs).asI_});
+  return Region;
+}
+
+std::vector<std::pair<uint32_t, OIInstList>> StaticCFG::getSpeculativeRegions(unsigned Max, unsigned MaxSize) {
+  // (Score, Size, Entry, End): deeper nesting first, then smaller regions
+  std::vector<std::tuple<unsigned, uint32_t, uint32_t, uint32_t>> Candidates;
+
+  for (auto& L : Loops) {
+    uint32_t Size = (L.Latch - L.Header) / 4 + 1;
+    if (Size > MaxSize || !isAllowedToStart(L.Header))
+      continue;
+
+    bool HasFittingParent = false;
+    unsigned Depth = L.Depth;
+    for (auto& K : Loops) {
+      if (K.Header <= L.Header && L.Latch <= K.Latch && (K.Header != L.Header || K.Latch != L.Latch))
+        HasFittingParent |= (K.Latch - K.Header) / 4 + 1 <= MaxSize;
+      if (L.Header <= K.Header && K.Latch <= L.Latch)
+        Depth = std::max(Depth, K.Depth);
+    }
+
+    if (!HasFittingParent)
+      Candidates.push_back(std::make_tuple(Depth, Size, L.Header, L.Latch + 4));
+  }
+
+  for (auto& C : CalledFromLoops) {
+    uint32_t End = getMethodEnd(C.first);
+    uint32_t Size = (End - C.first) / 4;
+    if (Size == 0 || Size > MaxSize || !isAllowedToStart(C.first) || TheMachine.getIntrinsic(C.first) != nullptr)
+      continue;
+    Candidates.push_back(std::make_tuple(C.second, Size, C.first, End));
+  }
+
+  std::sort(Candidates.begin(), Candidates.end(), [](const auto& A, const auto& B) {
+      return std::get<0>(A) > std::get<0>(B) || (std::get<0>(A) == std::get<0>(B) && std::get<1>(A) < std::get<1>(B)); });
+
+  std::vector<std::pair<uint32_t, OIInstList>> Regions;
+  std::set<uint32_t> Entries;
+  for (auto& C : Candidates) {
+    if (Regions.size() >= Max)
+      break;
+
+    uint32_t Entry = std::get<2>(C);
+    if (!Entries.insert(Entry).second)
+      continue;
+
+    Regions.push_back({Entry, getRegion(Entry, std::get<3>(C))});
+  }
+  return Regions;
+}
+
+std::vector<std::pair<uint32_t, OIInstList>> StaticCFG::getReachableMethods(std::set<uint32_t> Roots) {
+  std::set<uint32_t> Reached;
+  std::vector<uint32_t> Worklist(Roots.begin(), Roots.end());
+  while (!Worklist.empty()) {
+    uint32_t Method = Worklist.back();
+    Worklist.pop_back();
+    if (Method == 0 || !Reached.insert(Method).second)
+      continue;
+    for (auto Callee : Callees[Method])
+      Worklist.push_back(Callee);
+  }
+
+  std::vector<std::pair<uint32_t, OIInstList>> Regions;
+  for (auto Entry : Reached) {
+    uint32_t End = getMethodEnd(Entry);
+    if (End > Entry && isAllowedToStart(Entry) && TheMachine.getIntrinsic(Entry) == nullptr)
+      Regions.push_back({Entry, getRegion(Entry, End)});
+  }
+  return Regions;
+}
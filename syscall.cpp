@@ -8,12 +8,59 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#include <linux/fs.h>
+#include <algorithm>
+#include <cstring>
 #include <ostream>
 
 #include <ctime>
 
+#include "llvm/Support/DynamicLibrary.h"
+
 using namespace dbt;
 
+static SyscallManager* RegionSyscallManager = nullptr;
+static Machine* RegionSyscallMachine = nullptr;
+
+void SyscallManager::setAsRegionSyscallHandler(Machine& M) {
+  RegionSyscallManager = this;
+  RegionSyscallMachine = &M;
+  llvm::sys::DynamicLibrary::AddSymbol("dbt_region_syscall", reinterpret_cast<void*>(&dbt_region_syscall));
+}
+
+// The register file handed to regions is the machine's own, so the syscall sees the registers the
+// region stored and its results are seen by the code after it
+extern "C" int32_t dbt_region_syscall(int32_t* Regs, uint32_t* Mem) {
+  Machine& M = *RegionSyscallMachine;
+  if (!RegionSyscallManager->canRunInRegion(M))
+    return 1;
+  return RegionSyscallManager->processSyscall(M);
+}
+
+bool LinuxSyscallManager::canRunInRegion(Machine& M) {
+  switch (static_cast<SyscallType>(M.getRegister(4) - 4000)) {
+    case SyscallType::Read:
+    case SyscallType::Write:
+    case SyscallType::Open:
+    case SyscallType::Close:
+    case SyscallType::Creat:
+    case SyscallType::Lseek:
+    case SyscallType::Stat:
+    case SyscallType::Fstat:
+    case SyscallType::Brk:
+    case SyscallType::Mmap:
+    case SyscallType::Mmap2:
+    case SyscallType::Munmap:
+      return true;
+    default:
+      return false;
+  }
+}
+
 static inline int64_t cpucycles(void) {
   unsigned int hi, lo;
   unsigned int eax = 0;
@@ -29,11 +76,168 @@ static inline int64_t cpucycles(void) {
   return ((int64_t)lo) | (((int64_t)hi) << 32);
 }
 
+LinuxSyscallManager::~LinuxSyscallManager() {
+  flushWriteBuffers();
+}
+
+void LinuxSyscallManager::setWriteBufferSize(size_t Size) {
+  flushWriteBuffers();
+  WriteBufferSize = Size;
+  WriteBuffers.clear();
+  if (Size != 0) {
+    WriteBuffers[1].reserve(Size);
+    WriteBuffers[2].reserve(Size);
+  }
+}
+
+void LinuxSyscallManager::flushWriteBuffer(int FD) {
+  if (!isBuffered(FD))
+    return;
+
+  std::vector<char>& Buffer = WriteBuffers[FD];
+  size_t Done = 0;
+  while (Done < Buffer.size()) {
+    ssize_t r = write(FD, Buffer.data() + Done, Buffer.size() - Done);
+    FlushWrites += 1;
+    if (r <= 0 && errno != EINTR)
+      break;
+    if (r > 0)
+      Done += r;
+  }
+  Buffer.clear();
+}
+
+void LinuxSyscallManager::flushWriteBuffers() {
+  for (auto& KV : WriteBuffers)
+    flushWriteBuffer(KV.first);
+}
+
+bool LinuxSyscallManager::mayBlock(int FD) {
+  auto It = BlockingFDs.find(FD);
+  if (It != BlockingFDs.end())
+    return It->second;
+
+  struct stat St;
+  bool Blocks = fstat(FD, &St) != 0 || !S_ISREG(St.st_mode);
+  BlockingFDs[FD] = Blocks;
+  return Blocks;
+}
+
+void LinuxSyscallManager::flushTtyBuffers() {
+  for (auto& KV : WriteBuffers)
+    if (!KV.second.empty() && isatty(KV.first))
+      flushWriteBuffer(KV.first);
+}
+
+// Errors of buffered writes only show up at the flush, the guest always sees the whole count written
+ssize_t LinuxSyscallManager::bufferedWrite(int FD, const char* Data, size_t Count) {
+  // stdout and stderr usually end up in the same terminal/log, keep their relative order
+  if (FD == 1 || FD == 2)
+    flushWriteBuffer(3 - FD);
+
+  std::vector<char>& Buffer = WriteBuffers[FD];
+  if (Buffer.size() + Count > WriteBufferSize)
+    flushWriteBuffer(FD);
+
+  if (Count >= WriteBufferSize)
+    return write(FD, Data, Count);
+
+  Buffer.insert(Buffer.end(), Data, Data + Count);
+  BufferedWrites += 1;
+  return Count;
+}
+
+void LinuxSyscallManager::mapInputFile(int FD) {
+  struct stat St;
+  if (fstat(FD, &St) != 0 || !S_ISREG(St.st_mode) || St.st_size == 0)
+    return;
+
+  void* Data = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, FD, 0);
+  if (Data == MAP_FAILED)
+    return;
+
+  // Only a file that can't change (read-only mount, immutable) may back guest pages: those would keep
+  // following the file, and fault once it is truncated
+  struct statvfs Vfs;
+  int Flags = 0;
+  bool Stable = (fstatvfs(FD, &Vfs) == 0 && (Vfs.f_flag & ST_RDONLY)) ||
+                (ioctl(FD, FS_IOC_GETFLAGS, &Flags) == 0 && (Flags & FS_IMMUTABLE_FL));
+
+  madvise(Data, St.st_size, MADV_SEQUENTIAL);
+  MappedFiles[FD] = {static_cast<char*>(Data), static_cast<size_t>(St.st_size), 0, Stable};
+}
+
+void LinuxSyscallManager::unmapInputFile(int FD) {
+  auto It = MappedFiles.find(FD);
+  if (It == MappedFiles.end())
+    return;
+  munmap(It->second.Data, It->second.Size);
+  MappedFiles.erase(It);
+}
+
+// Whole pages of stable files are mapped straight into the guest window when the destination and the file
+// offset agree on the page alignment, the rest is copied. The mapping is private, so guest stores never
+// reach the file.
+ssize_t LinuxSyscallManager::mappedRead(int FD, char* Dst, size_t Count) {
+  MappedFile& F = MappedFiles[FD];
+  size_t N = std::min(Count, F.Size - std::min(F.Offset, F.Size));
+  size_t Done = 0;
+
+  static const size_t PageSize = sysconf(_SC_PAGESIZE);
+  size_t Head = (PageSize - reinterpret_cast<uintptr_t>(Dst) % PageSize) % PageSize;
+  if (F.Stable && Head < N && (F.Offset + Head) % PageSize == 0 && N - Head >= PageSize) {
+    size_t Pages = (N - Head) / PageSize * PageSize;
+    if (mmap(Dst + Head, Pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, FD, F.Offset + Head) != MAP_FAILED) {
+      std::memcpy(Dst, F.Data + F.Offset, Head);
+      std::memcpy(Dst + Head + Pages, F.Data + F.Offset + Head + Pages, N - Head - Pages);
+      RemappedBytes += Pages;
+      Done = N;
+    }
+  }
+
+  if (Done == 0)
+    std::memcpy(Dst, F.Data + F.Offset, N);
+
+  F.Offset += N;
+  MappedBytes += N;
+  return N;
+}
+
+off_t LinuxSyscallManager::mappedSeek(int FD, off_t Offset, int Whence) {
+  MappedFile& F = MappedFiles[FD];
+  off_t Base = Whence == SEEK_SET ? 0 : (Whence == SEEK_CUR ? F.Offset : F.Size);
+  if (Base + Offset < 0)
+    return -1;
+  F.Offset = Base + Offset;
+  return F.Offset;
+}
+
+// The first three arguments come in r5-r7, the following ones in the outgoing argument area of the stack
+static uint32_t getSyscallArgument(Machine& M, unsigned N) {
+  if (N < 3)
+    return M.getRegister(5 + N);
+  return M.getMemValueAt(M.getRegister(29) + 16 + 4 * (N - 3)).asI_;
+}
+
+#define GUEST_MAP_ANONYMOUS 0x800
+
 int LinuxSyscallManager::processSyscall(Machine& M) {
   SyscallType SysTy = static_cast<SyscallType>(M.getRegister(4) - 4000);
 
   switch (SysTy) {
   case SyscallType::Exit:
+    if (WriteBufferSize != 0) {
+      flushWriteBuffers();
+      std::cerr << "Write buffering saved " << getSavedWriteSyscalls() << " host syscalls\n";
+    }
+    if (M.getPeakBreakUse() != 0 || M.getPeakMappedBytes() != 0) {
+      struct rusage Usage;
+      getrusage(RUSAGE_SELF, &Usage);
+      std::cerr << "Guest heap peak: " << M.getPeakBreakUse() / 1024 << " kB (brk), " << M.getPeakMappedBytes() / 1024
+        << " kB (mmap); host max RSS: " << Usage.ru_maxrss << " kB\n";
+    }
+    if (IsToMapInputFiles)
+      std::cerr << "Mapped input: " << MappedBytes << " bytes read, " << RemappedBytes << " bytes remapped\n";
     ExitStatus = M.getRegister(2);
     std::cerr << "Exiting with status " << (uint32_t) ExitStatus << " (" << M.getRegister(2) << ")\n";
     return 1;
@@ -47,11 +251,24 @@ int LinuxSyscallManager::processSyscall(Machine& M) {
   //GET/PUT right registers and memory locations
   case SyscallType::Read:{
     //fflush(stdin);
+    flushWriteBuffer(M.getRegister(5));
+    // Interactive guests print a prompt (stdout or stderr) before reading
+    if (WriteBufferSize != 0 && mayBlock(M.getRegister(5)))
+      flushTtyBuffers();
+    if (MappedFiles.count(M.getRegister(5)) != 0) {
+      M.setRegister(2, mappedRead(M.getRegister(5), M.getByteMemoryPtr() + (M.getRegister(6) - M.getDataMemOffset()), M.getRegister(7)));
+      return 0;
+    }
     ssize_t r = read(M.getRegister(5), (M.getByteMemoryPtr() + (M.getRegister(6) - M.getDataMemOffset())), M.getRegister(7));
     M.setRegister(2, r);
     return 0;
   }
   case SyscallType::Write: {
+    if (isBuffered(M.getRegister(5))) {
+      M.setRegister(2, bufferedWrite(M.getRegister(5), M.getByteMemoryPtr() + (M.getRegister(6) - M.getDataMemOffset()), M.getRegister(7)));
+      return 0;
+    }
+
     ssize_t r = write(M.getRegister(5), (M.getByteMemoryPtr() + (M.getRegister(6) - M.getDataMemOffset())), M.getRegister(7));
     M.setRegister(2, r);
     return 0;
@@ -69,6 +286,11 @@ int LinuxSyscallManager::processSyscall(Machine& M) {
 
     M.setRegister(2, r);
 
+    if (WriteBufferSize != 0 && r > 2 && (flags & O_ACCMODE) != O_RDONLY)
+      WriteBuffers[r].clear();
+    if (IsToMapInputFiles && r > 2 && (flags & O_ACCMODE) == O_RDONLY)
+      mapInputFile(r);
+
     #ifdef DEBUG
     std::cerr << "Open file: " << filename << "; Flags:" << flags << " (r=" << r << ")" << std::endl;
     assert(r >= 0 && "Error with file descriptor..");
@@ -79,7 +301,11 @@ int LinuxSyscallManager::processSyscall(Machine& M) {
 
   case SyscallType::Close: {
     auto FD = M.getRegister(5);
+    flushWriteBuffer(FD);
+    BlockingFDs.erase(FD);
     if (FD > 2) {
+      WriteBuffers.erase(FD);
+      unmapInputFile(FD);
       ssize_t r = close(FD);
       M.setRegister(2, r);
     } else {
@@ -95,15 +321,44 @@ int LinuxSyscallManager::processSyscall(Machine& M) {
     ssize_t r = creat(filename, flags);
     M.setRegister(2, r);
 
+    if (WriteBufferSize != 0 && r > 2)
+      WriteBuffers[r].clear();
+
     assert(r >= 0 && "Error with file descriptor..");
     return 0;
   }
 
+  case SyscallType::Brk: {
+    M.setRegister(2, M.setBreak(getSyscallArgument(M, 0)));
+    return 0;
+  }
+
+  // Only anonymous mappings are supported, placed wherever there is room (hints and MAP_FIXED are ignored)
+  case SyscallType::Mmap:
+  case SyscallType::Mmap2: {
+    uint32_t Size  = getSyscallArgument(M, 1);
+    uint32_t Flags = getSyscallArgument(M, 3);
+
+    uint32_t Addrs = 0;
+    if ((Flags & GUEST_MAP_ANONYMOUS) != 0)
+      Addrs = M.mapAnonymous(Size);
+
+    M.setRegister(2, Addrs == 0 ? -1 : Addrs);
+    return 0;
+  }
+
+  case SyscallType::Munmap: {
+    M.unmapAnonymous(getSyscallArgument(M, 0), getSyscallArgument(M, 1));
+    M.setRegister(2, 0);
+    return 0;
+  }
+
   //Hack for rtdsc instruction
   case SyscallType::Stat: {
     static int64_t cpuc = 0;
     static uint32_t times = 0;
 
+    flushWriteBuffer(1);
     std::cout << "[" << times++ << "]: " << (cpucycles()-cpuc) << std::endl;
     cpuc = cpucycles();
     return 0;
@@ -113,6 +368,11 @@ int LinuxSyscallManager::processSyscall(Machine& M) {
     //const char* filename = M.getByteMemoryPtr() + (M.getRegister(5) - M.getDataMemOffset());
     //const int flags = M.getRegister(6);
 
+    flushWriteBuffer(M.getRegister(5));
+    if (MappedFiles.count(M.getRegister(5)) != 0) {
+      M.setRegister(2, mappedSeek(M.getRegister(5), M.getRegister(6), M.getRegister(7)));
+      return 0;
+    }
     ssize_t r = lseek(M.getRegister(5), M.getRegister(6), M.getRegister(7));
     M.setRegister(2, r);
 
@@ -121,6 +381,7 @@ int LinuxSyscallManager::processSyscall(Machine& M) {
   }
 
   default:
+    flushWriteBuffers();
     std::cerr << "Syscall (" << SysTy << ") not implemented!\n";
     exit(2);
     break;
@@ -0,0 +1,163 @@
+#include <syscallLog.hpp>
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace dbt;
+
+#define SYSCALL_LOG_MAGIC 0x4c53494f /* OISL */
+
+template <typename T>
+static void writeValue(std::ofstream& OS, T Value) {
+  OS.write(reinterpret_cast<const char*>(&Value), sizeof(T));
+}
+
+template <typename T>
+static bool readValue(std::ifstream& IS, T& Value) {
+  return static_cast<bool>(IS.read(reinterpret_cast<char*>(&Value), sizeof(T)));
+}
+
+// Guest memory ranges written by a syscall, once it returned Result
+static std::vector<std::pair<uint32_t, uint32_t>> getWrittenMemory(uint32_t Number, const std::array<int32_t, 3>& Args, int32_t Result) {
+  switch (Number) {
+    case LinuxSyscallManager::Read:
+      if (Result > 0)
+        return {{Args[1], Result}};
+      return {};
+    default:
+      return {};
+  }
+}
+
+static bool isReplayedOnInner(uint32_t Number, const std::array<int32_t, 3>& Args) {
+  switch (Number) {
+    case LinuxSyscallManager::Brk:
+    case LinuxSyscallManager::Mmap:
+    case LinuxSyscallManager::Mmap2:
+    case LinuxSyscallManager::Munmap:
+    case LinuxSyscallManager::Exit:
+      return true;
+    case LinuxSyscallManager::Write:
+      return Args[0] == 1 || Args[0] == 2;
+    default:
+      return false;
+  }
+}
+
+// The inner manager exits on syscalls it doesn't implement, the log must still hold everything before them
+static std::ofstream* OpenLog = nullptr;
+
+static void flushOpenLog() {
+  if (OpenLog != nullptr)
+    OpenLog->flush();
+}
+
+RecordingSyscallManager::RecordingSyscallManager(std::string Path, std::unique_ptr<SyscallManager> I) :
+  Inner(std::move(I)), Log(Path, std::ios::binary | std::ios::trunc) {
+  if (!Log) {
+    std::cerr << "Can't open the syscall log " << Path << "\n";
+    exit(1);
+  }
+  writeValue<uint32_t>(Log, SYSCALL_LOG_MAGIC);
+
+  if (OpenLog == nullptr)
+    std::atexit(flushOpenLog);
+  OpenLog = &Log;
+}
+
+RecordingSyscallManager::~RecordingSyscallManager() {
+  if (OpenLog == &Log)
+    OpenLog = nullptr;
+}
+
+int RecordingSyscallManager::processSyscall(Machine& M) {
+  uint32_t Number = M.getRegister(4) - 4000;
+  std::array<int32_t, 3> Args = {M.getRegister(5), M.getRegister(6), M.getRegister(7)};
+
+  int Stop = Inner->processSyscall(M);
+  int32_t Result = M.getRegister(2);
+  ExitStatus = Inner->getExitStatus();
+
+  auto Written = getWrittenMemory(Number, Args, Result);
+
+  writeValue<uint16_t>(Log, Number);
+  for (auto A : Args)
+    writeValue<int32_t>(Log, A);
+  writeValue<int32_t>(Log, Result);
+  writeValue<uint8_t>(Log, Stop);
+  writeValue<uint8_t>(Log, Written.size());
+  for (auto Range : Written) {
+    writeValue<uint32_t>(Log, Range.first);
+    writeValue<uint32_t>(Log, Range.second);
+    Log.write(M.getByteMemoryPtr() + (Range.first - M.getDataMemOffset()), Range.second);
+  }
+
+  if (Stop)
+    Log.flush();
+  return Stop;
+}
+
+ReplaySyscallManager::ReplaySyscallManager(std::string Path, std::unique_ptr<SyscallManager> I) :
+  Inner(std::move(I)), Log(Path, std::ios::binary) {
+  uint32_t Magic = 0;
+  if (!Log || !readValue(Log, Magic) || Magic != SYSCALL_LOG_MAGIC) {
+    std::cerr << "Can't read the syscall log " << Path << "\n";
+    exit(1);
+  }
+}
+
+bool ReplaySyscallManager::readEntry(SyscallLogEntry& E) {
+  uint16_t Number;
+  uint8_t NumWritten;
+  if (!readValue(Log, Number))
+    return false;
+  E.Number = Number;
+  for (auto& A : E.Args)
+    readValue(Log, A);
+  readValue(Log, E.Result);
+  readValue(Log, E.Stop);
+  readValue(Log, NumWritten);
+
+  E.Written.clear();
+  for (uint8_t I = 0; I < NumWritten; I++) {
+    uint32_t Addrs, Size;
+    readValue(Log, Addrs);
+    readValue(Log, Size);
+    std::string Data(Size, '\0');
+    Log.read(&Data[0], Size);
+    E.Written.push_back({Addrs, Data});
+  }
+  return static_cast<bool>(Log);
+}
+
+int ReplaySyscallManager::processSyscall(Machine& M) {
+  uint32_t Number = M.getRegister(4) - 4000;
+
+  SyscallLogEntry E;
+  if (!readEntry(E)) {
+    std::cerr << "Syscall log ended after " << Replayed << " syscalls (next: " << Number << ")\n";
+    exit(2);
+  }
+
+  std::array<int32_t, 3> Args = {M.getRegister(5), M.getRegister(6), M.getRegister(7)};
+  if (E.Number != Number || E.Args != Args) {
+    std::cerr << "Replay diverged at syscall " << Replayed << ": expected " << E.Number << "(" << E.Args[0] << ", "
+      << E.Args[1] << ", " << E.Args[2] << ") but got " << Number << "(" << Args[0] << ", " << Args[1] << ", " << Args[2]
+      << ")\n";
+    exit(2);
+  }
+  Replayed += 1;
+
+  if (isReplayedOnInner(Number, Args)) {
+    int Stop = Inner->processSyscall(M);
+    ExitStatus = Inner->getExitStatus();
+    if (Number != LinuxSyscallManager::Write)
+      return Stop;
+  }
+
+  for (auto& W : E.Written)
+    std::copy(W.second.begin(), W.second.end(), M.getByteMemoryPtr() + (W.first - M.getDataMemOffset()));
+
+  M.setRegister(2, E.Result);
+  return E.Stop;
+}